@@ -16,6 +16,12 @@ but 32 */
 #define OFF_T         CURLOPTTYPE_OFF_T
 #define CINIT(na,t,nu) CURLOPT_ ## na = CURLOPTTYPE_ ## t + nu
 
+/* linked-list structure for the CURLOPT_QUOTE option (and other) */
+struct curl_slist {
+	char *data;
+	struct curl_slist *next;
+};
+
 /*
 * This macro-mania below setups the CURLOPT_[what] enum, to be used with
 * curl_easy_setopt(). The first argument in the CINIT() macro is the [what]
@@ -9,9 +9,17 @@
 */
 
 #include "Configuration/All.h"
+#include "Utilities/Indigo/core/handle_registry.hpp"
+#include "Utilities/Indigo/core/object_pool.hpp"
 #include "Utilities/Indigo/utility/hook.hpp"
 #include "Utilities/Indigo/utility/acp_dump.hpp"
+#include "Utilities/Indigo/utility/flow_allocator.hpp"
 #include "Utilities/Indigo/utility/config.hpp"
+#include "Utilities/Indigo/utility/trace.hpp"
+#include "Utilities/Indigo/utility/capture_filter.hpp"
+#include "Utilities/Indigo/utility/capture_sampler.hpp"
+#include "Utilities/Indigo/utility/pe_image.hpp"
+#include "Utilities/Indigo/utility/signature_cache.hpp"
 #include "Curl.h"
 
 #ifdef _DEBUG
@@ -20,8 +28,6 @@
 
 #include <fstream>
 #include <cstdarg>
-#include <map>
-#include <mutex>
 #include <thread>
 #include <chrono>
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
@@ -34,156 +40,404 @@ typedef size_t (*__cdecl CurlIOCallback)(char *data, size_t size, size_t bytes,
 struct CurlInstance {
 	void *Handle;
 	bool Used;
+	bool Wrapped; // Our callbacks are installed on the handle
+	bool Captured; // The transfer passed the filter and owns a flow
+	bool SampledOut; // The sampler turned the transfer down, it isn't asked again for it
 	void *WriteData;
 	void *ReadData;
 	CurlIOCallback WriteCallback;
 	CurlIOCallback ReadCallback;
+	indigo::CaptureFlow Flow;
+	uint64_t WriteBytes; // Response body seen so far
+	uint64_t ReadBytes; // Request body seen so far
+	std::string Url;
+	std::string Method; // Implied by CURLOPT_POST, CURLOPT_UPLOAD, ...
+	std::string CustomMethod; // From CURLOPT_CUSTOMREQUEST
+	std::string ContentType; // From the Content-Type header in CURLOPT_HTTPHEADER
+
+	CurlInstance() {
+		Reset();
+	}
+
+	// Back to a fresh record when the pool takes it back, the strings keep
+	// their memory for the next handle
+	void Reset() {
+		Handle = nullptr;
+		Used = false;
+		Wrapped = false;
+		Captured = false;
+		SampledOut = false;
+		WriteData = nullptr;
+		ReadData = nullptr;
+		WriteCallback = nullptr;
+		ReadCallback = nullptr;
+		Flow = indigo::CaptureFlow();
+		WriteBytes = 0;
+		ReadBytes = 0;
+		Url.clear();
+		Method.clear();
+		CustomMethod.clear();
+		ContentType.clear();
+	}
 };
 
+// Records are recycled rather than destroyed, so URLs longer than the small
+// string buffer don't allocate again for every handle
+typedef indigo::ObjectPool<CurlInstance, 64, 32, true> CurlInstancePool;
+
 indigo::ACPDump acp_dump_;
-std::map<void *, CurlInstance *> instances_;
-std::mutex instances_mutex_;
+indigo::FlowAllocator flow_allocator_;
+indigo::CaptureFilter capture_filter_;
+indigo::CaptureSampler capture_sampler_;
+uint64_t body_budget_ = 0;
+indigo::HandleRegistry<CurlInstance> instances_;
 indigo::CallHook curl_setopt_hook_;
 indigo::CallHook curl_close_hook_;
 
-size_t curl_write_callback(char *data, size_t size, size_t bytes, CurlInstance *instance) {
-	printf("CurlDump: (0x%08p) Writing %d bytes\n", instance->Handle, bytes);
+// Bytes of a chunk to capture, a body is only captured up to the budget and
+// counted after that
+size_t capture_length(uint64_t &seen, size_t bytes) {
+	uint64_t offset = seen;
+	seen += bytes;
 
+	if (body_budget_ == 0) {
+		return bytes;
+	}
+	if (offset >= body_budget_) {
+		return 0;
+	}
+	return body_budget_ - offset < bytes ? static_cast<size_t>(body_budget_ - offset) : bytes;
+}
+
+size_t curl_write_callback(char *data, size_t size, size_t bytes, CurlInstance *instance) {
 	// Mark as used
 	instance->Used = true;
 
-	acp_dump_.Write(SOCK_STREAM, IPPROTO_TCP, static_cast<uint32_t>(inet_addr("127.0.0.1")),
-		reinterpret_cast<uint16_t>(instance->Handle), reinterpret_cast<uint32_t>(instance->Handle), 1337, data, bytes);
+	if (instance->Captured) {
+		INDIGO_TRACE(indigo::kTraceLevel_Verbose, "CurlDump: (0x%08p) Writing %d bytes", instance->Handle, bytes);
+
+		acp_dump_.WriteFlow(instance->Flow.Id, indigo::kACPDirection_ServerToClient, instance->Flow.ClientAddress, instance->Flow.ClientPort,
+			instance->Flow.ServerAddress, instance->Flow.ServerPort, data, bytes, capture_sampler_.Take(capture_length(instance->WriteBytes, bytes)));
+	}
 
 	return instance->WriteCallback != nullptr ? instance->WriteCallback(data, size, bytes, instance->WriteData) : bytes;
 }
 
 size_t curl_read_callback(char *data, size_t size, size_t bytes, CurlInstance *instance) {
-	printf("CurlDump: (0x%08p) Reading %d bytes\n", instance->Handle, bytes);
-
 	// Mark as used
 	instance->Used = true;
 
-	acp_dump_.Write(SOCK_STREAM, IPPROTO_TCP, reinterpret_cast<uint32_t>(instance->Handle), 1337,
-		static_cast<uint32_t>(inet_addr("127.0.0.1")), reinterpret_cast<uint16_t>(instance->Handle), data, bytes);
+	if (instance->Captured) {
+		INDIGO_TRACE(indigo::kTraceLevel_Verbose, "CurlDump: (0x%08p) Reading %d bytes", instance->Handle, bytes);
+
+		acp_dump_.WriteFlow(instance->Flow.Id, indigo::kACPDirection_ClientToServer, instance->Flow.ClientAddress, instance->Flow.ClientPort,
+			instance->Flow.ServerAddress, instance->Flow.ServerPort, data, bytes, capture_sampler_.Take(capture_length(instance->ReadBytes, bytes)));
+	}
 
 	return instance->ReadCallback != nullptr ? instance->ReadCallback(data, size, bytes, instance->ReadData) : bytes;
 }
 
-// int __cdecl Curl_setopt(void *handle, signed int option, va_list param)
-int __cdecl curl_setopt_(void *handle, signed int option, va_list param) {
-	printf("CurlDump: Curl_setopt(0x%08p, %d, 0x%08p)\n", handle, option, param);
+// Calls the original Curl_setopt
+int curl_setopt_original(void *handle, CURLoption option, ...) {
+	va_list param;
+	va_start(param, option);
 
-	// Curl instance
-	CurlInstance *instance;
-
-	// Get the original
-	auto curl_setopt = curl_setopt_hook_.Get<int(*__cdecl)(void *, signed int, va_list)>();
+	int result = curl_setopt_hook_.Get<int(*__cdecl)(void *, signed int, va_list)>()(handle, option, param);
 
-	instances_mutex_.lock();
+	va_end(param);
+	return result;
+}
 
-	// Check if an instance already exists and has been used
-	std::map<void *, CurlInstance *>::iterator it;
-	if ((it = instances_.find(handle)) != instances_.end()) {
-		if (it->second->Used) {
-			// Remove it from our instances list
-			delete it->second;
-			instances_.erase(it);
+// The method the transfer will use, as far as the options tell. A custom
+// method is uppercased so a filter on "POST" also matches "post".
+std::string curl_method(CurlInstance *instance) {
+	if (!instance->CustomMethod.empty()) {
+		std::string method = instance->CustomMethod;
+		for (char &character : method) {
+			character = static_cast<char>(toupper(static_cast<unsigned char>(character)));
 		}
+		return method;
 	}
+	return instance->Method.empty() ? "GET" : instance->Method;
+}
 
-	if (instances_.find(handle) == instances_.end()) {
-		// Initialize
-		printf("CurlDump: Monitoring easy handle 0x%08p\n", handle);
+// Returns the value of the Content-Type header in a header list
+std::string curl_content_type(const curl_slist *headers) {
+	static const char kName[] = "Content-Type:";
+	for (; headers != nullptr; headers = headers->next) {
+		if (headers->data == nullptr || !indigo::String::Equals(std::string(headers->data).substr(0, sizeof(kName) - 1), kName, true)) {
+			continue;
+		}
+		const char *value = headers->data + sizeof(kName) - 1;
+		while (*value == ' ' || *value == '\t') {
+			value++;
+		}
+		return value;
+	}
+	return std::string();
+}
 
-		// Create curl instance
-		instance = new CurlInstance{ nullptr };
-		instance->Handle = handle;
+// Runs the filter once the URL is known. Captured handles get a flow and our
+// callbacks, filtered handles are left alone unless an earlier transfer on
+// them was captured, then the callbacks only pass data through.
+void curl_update_capture(CurlInstance *instance) {
+	if (instance->Url.empty()) {
+		return;
+	}
 
-		if (option == CURLOPT_WRITEDATA) {
-			instance->WriteData = va_arg(param, void *);
-		} else if (option == CURLOPT_READDATA) {
-			instance->ReadData = va_arg(param, void *);
-		} else if (option == CURLOPT_WRITEFUNCTION) {
-			instance->WriteCallback = va_arg(param, CurlIOCallback);
-		} else if (option == CURLOPT_READFUNCTION) {
-			instance->ReadCallback = va_arg(param, CurlIOCallback);
+	std::string method = curl_method(instance);
+	if (!capture_filter_.Matches(instance->Url, method, instance->ContentType)) {
+		if (instance->Captured) {
+			acp_dump_.CloseFlow(instance->Flow.Id);
+			flow_allocator_.Release(instance->Handle);
+			capture_sampler_.Leave();
+			instance->Captured = false;
 		}
+		INDIGO_TRACE(indigo::kTraceLevel_Debug, "CurlDump: Skipping %s %s on easy handle 0x%08p", method, instance->Url, instance->Handle);
+		return;
+	}
 
-		auto setopt = [=](CURLoption opt, ...) {
-			printf("CurlDump: Setting option %d for easy handle 0x%08p\n", opt, handle);
+	if (!instance->Captured) {
+		// Asked once per transfer, so it's counted once and doesn't change its
+		// mind while the transfer is still being set up
+		if (instance->SampledOut) {
+			return;
+		}
+		if (!capture_sampler_.Admit(instance->Handle, instance->Url)) {
+			instance->SampledOut = true;
+			INDIGO_TRACE(indigo::kTraceLevel_Debug, "CurlDump: Sampling out %s %s on easy handle 0x%08p", method, instance->Url, instance->Handle);
+			return;
+		}
+		instance->Flow = flow_allocator_.Acquire(instance->Handle);
+		instance->Captured = true;
+	}
 
-			va_list va;
-			va_start(va, opt);
+	acp_dump_.SetFlowComment(instance->Flow.Id, indigo::String::Format("transfer=%llu handle=0x%p method=%s url=%s",
+		instance->Flow.Id, instance->Handle, method.c_str(), instance->Url.c_str()));
 
-			curl_setopt(handle, opt, va);
+	if (!instance->Wrapped) {
+		INDIGO_TRACE(indigo::kTraceLevel_Info, "CurlDump: Monitoring easy handle 0x%08p", instance->Handle);
 
-			va_end(va);
-		};
+		curl_setopt_original(instance->Handle, CURLOPT_VERBOSE, 0);
+		curl_setopt_original(instance->Handle, CURLOPT_WRITEDATA, instance);
+		curl_setopt_original(instance->Handle, CURLOPT_READDATA, instance);
+		curl_setopt_original(instance->Handle, CURLOPT_WRITEFUNCTION, &curl_write_callback);
+		curl_setopt_original(instance->Handle, CURLOPT_READFUNCTION, &curl_read_callback);
+		instance->Wrapped = true;
+	}
+}
 
-		setopt(CURLOPT_VERBOSE, 0);
-		setopt(CURLOPT_WRITEDATA, instance);
-		setopt(CURLOPT_READDATA, instance);
-		setopt(CURLOPT_WRITEFUNCTION, &curl_write_callback);
-		setopt(CURLOPT_READFUNCTION, &curl_read_callback);
+// int __cdecl Curl_setopt(void *handle, signed int option, va_list param)
+int __cdecl curl_setopt_(void *handle, signed int option, va_list param) {
+	INDIGO_TRACE(indigo::kTraceLevel_Verbose, "CurlDump: Curl_setopt(0x%08p, %d, 0x%08p)", handle, option, param);
 
-		instances_[handle] = instance;
-		instances_mutex_.unlock();
+	// Curl instance
+	CurlInstance *instance;
+	bool reused = false;
+
+	// Only the thread using the handle gets here for it, so the instance can't
+	// change under us
+	instance = instances_.Find(handle);
+	if (instance == nullptr) {
+		// Initialize, the handle is only wrapped once a transfer on it passes the filter
+		instance = CurlInstancePool::New();
+		instance->Handle = handle;
+		instances_.Insert(handle, instance);
 	} else {
-		instance = instances_[handle];
-		instances_mutex_.unlock();
-
-		if (option == CURLOPT_WRITEDATA) {
-			instance->WriteData = va_arg(param, void *);
-			return 0;
-		}
-		if (option == CURLOPT_READDATA) {
-			instance->ReadData = va_arg(param, void *);
-			return 0;
+		if (instance->Used) {
+			// The handle is being reused for a new transfer, end the old flow. The
+			// instance stays, it may still be installed on the handle
+			if (instance->Captured) {
+				acp_dump_.CloseFlow(instance->Flow.Id);
+				flow_allocator_.Release(handle);
+				capture_sampler_.Leave();
+				instance->Captured = false;
+			}
+			instance->Used = false;
+			instance->SampledOut = false;
+			instance->WriteBytes = 0;
+			instance->ReadBytes = 0;
+			reused = true;
 		}
-		if (option == CURLOPT_WRITEFUNCTION) {
-			instance->WriteCallback = va_arg(param, CurlIOCallback);
-			return 0;
+	}
+
+	// Read the value from a copy, the original still needs param
+	va_list value;
+	va_copy(value, param);
+
+	bool update = reused; // The options of the last transfer carry over
+	bool swallow = false;
+	switch (option) {
+	case CURLOPT_WRITEDATA:
+		instance->WriteData = va_arg(value, void *);
+		swallow = instance->Wrapped;
+		break;
+	case CURLOPT_READDATA:
+		instance->ReadData = va_arg(value, void *);
+		swallow = instance->Wrapped;
+		break;
+	case CURLOPT_WRITEFUNCTION:
+		instance->WriteCallback = va_arg(value, CurlIOCallback);
+		swallow = instance->Wrapped;
+		break;
+	case CURLOPT_READFUNCTION:
+		instance->ReadCallback = va_arg(value, CurlIOCallback);
+		swallow = instance->Wrapped;
+		break;
+	case CURLOPT_URL: {
+		const char *url = va_arg(value, const char *);
+		instance->Url = url != nullptr ? url : "";
+		// Handles we never wrapped don't see Used set, a new URL is where their
+		// next transfer starts
+		instance->SampledOut = false;
+		update = true;
+		break;
+	}
+	case CURLOPT_CUSTOMREQUEST: {
+		const char *method = va_arg(value, const char *);
+		instance->CustomMethod = method != nullptr ? method : "";
+		update = true;
+		break;
+	}
+	case CURLOPT_POST:
+		instance->Method = va_arg(value, long) != 0 ? "POST" : "GET";
+		update = true;
+		break;
+	case CURLOPT_POSTFIELDS:
+	case CURLOPT_COPYPOSTFIELDS:
+		instance->Method = "POST";
+		update = true;
+		break;
+	case CURLOPT_UPLOAD:
+		instance->Method = va_arg(value, long) != 0 ? "PUT" : "GET";
+		update = true;
+		break;
+	case CURLOPT_NOBODY:
+		instance->Method = va_arg(value, long) != 0 ? "HEAD" : "GET";
+		update = true;
+		break;
+	case CURLOPT_HTTPGET:
+		if (va_arg(value, long) != 0) {
+			instance->Method = "GET";
 		}
-		if (option == CURLOPT_READFUNCTION) {
-			instance->ReadCallback = va_arg(param, CurlIOCallback);
-			return 0;
+		update = true;
+		break;
+	case CURLOPT_HTTPHEADER:
+		instance->ContentType = curl_content_type(va_arg(value, const curl_slist *));
+		update = true;
+		break;
+	default:
+		break;
+	}
+
+	va_end(value);
+
+	// Our callbacks stay installed, they forward to the ones recorded above
+	if (swallow) {
+		if (update) {
+			curl_update_capture(instance);
 		}
+		return 0;
+	}
+
+	int result = curl_setopt_hook_.Get<int(*__cdecl)(void *, signed int, va_list)>()(handle, option, param);
+
+	// Decide after the option is applied so wrapping can't be overridden by it
+	if (update) {
+		curl_update_capture(instance);
 	}
 
-	return curl_setopt(handle, option, param);
+	return result;
 }
 
 // int __cdecl Curl_close(void *handle)
 int __cdecl curl_close_(void *handle) {
-	printf("CurlDump: Curl_close(0x%08p)\n", handle);
-	instances_mutex_.lock();
-	for (auto it = instances_.begin(); it != instances_.end();) {
-		if (it->first == handle) {
-			delete it->second;
-			instances_.erase(it);
-			break;
-		} 
-		++it;
+	INDIGO_TRACE(indigo::kTraceLevel_Debug, "CurlDump: Curl_close(0x%08p)", handle);
+	CurlInstance *instance = instances_.Remove(handle);
+	if (instance != nullptr) {
+		if (instance->Captured) {
+			acp_dump_.CloseFlow(instance->Flow.Id);
+			flow_allocator_.Release(handle);
+			capture_sampler_.Leave();
+		}
+		CurlInstancePool::Delete(instance);
 	}
-	instances_mutex_.unlock();
 
 	return curl_close_hook_.Get<int(*__cdecl)(void *)>()(handle);
 }
 
+// Finds the hook targets. They come from the signature cache if the image is
+// the one they were cached for and still match there, otherwise the image is
+// scanned and the cache updated. An empty cache_path disables the cache.
+std::vector<void *> curl_find_targets(const indigo::MultiScanner &scanner, const std::string &cache_path, size_t threads, bool all_sections) {
+	indigo::PEImage image(indigo::Memory::GetProcessBaseAddress(), indigo::Memory::GetProcessImageSize(), indigo::kPEImageLayout_Loaded);
+	indigo::ModuleIdentity identity = image.GetIdentity();
+
+	// A cache that doesn't exist yet is just empty
+	indigo::SignatureCache cache;
+	if (!cache_path.empty()) {
+		cache.Load(cache_path);
+	}
+
+	std::vector<void *> targets(scanner.GetCount(), nullptr);
+	bool cached = !cache_path.empty();
+	for (size_t i = 0; i < scanner.GetCount() && cached; i++) {
+		uint32_t rva;
+		cached = cache.Resolve(image, identity, scanner.Get(i), rva);
+		if (cached) {
+			targets[i] = const_cast<uint8_t *>(image.GetPointer(rva));
+		}
+	}
+	if (cached) {
+		INDIGO_TRACE(indigo::kTraceLevel_Info, "CurlDump: Hook targets taken from %s", cache_path);
+		return targets;
+	}
+
+	// Only code sections unless asked otherwise, split between the workers
+	std::vector<indigo::ScanRange> ranges;
+	if (all_sections) {
+		ranges.push_back(indigo::ScanRange{ static_cast<const uint8_t *>(indigo::Memory::GetProcessBaseAddress()), indigo::Memory::GetProcessImageSize() });
+	} else {
+		ranges = indigo::Memory::GetCodeRanges();
+	}
+	targets = indigo::Memory::Find(scanner, ranges, threads);
+
+	if (!cache_path.empty()) {
+		for (size_t i = 0; i < targets.size(); i++) {
+			uint32_t rva;
+			if (targets[i] != nullptr && image.GetRVA(targets[i], rva)) {
+				cache.Store(identity, scanner.Get(i), rva);
+			}
+		}
+		if (cache.IsDirty() && !cache.Save(cache_path)) {
+			printf("CurlDump: Failed to write %s\n", cache_path.c_str());
+		}
+	}
+
+	return targets;
+}
+
 extern "C" {
 	EXPORT_ATTR void __cdecl onExtensionUnloading(void) {
 		// Remove curl instances
-		instances_mutex_.lock();
-		for (auto it = instances_.begin(); it != instances_.end();) {
-			delete it->second;
-			it = instances_.erase(it);
-		}
-		instances_mutex_.unlock();
+		instances_.Clear([](CurlInstance *instance) {
+			CurlInstancePool::Delete(instance);
+		});
+		flow_allocator_.Clear();
 
 		// Close dump
 		acp_dump_.Close();
 
+		// Write out pending trace records
+		indigo::Trace::Stop();
+
+		printf("CurlDump: %llu packets enqueued, %llu written, %llu dropped, %llu body bytes not captured, %llu transfers sampled out\n", 
+			acp_dump_.GetPacketsEnqueued(), acp_dump_.GetPacketsWritten(), acp_dump_.GetPacketsDropped(), acp_dump_.GetBytesTruncated(), 
+			capture_sampler_.GetTransfersSkipped());
+		if (acp_dump_.GetRotationsFailed() > 0) {
+			printf("CurlDump: The next capture file couldn't be opened %llu times\n", acp_dump_.GetRotationsFailed());
+		}
+
 #ifdef _DEBUG
 		indigo::Console::Hide();
 #endif
@@ -218,17 +472,102 @@ extern "C" {
 			return;
 		}
 
+		// Start tracing. Without a level everything compiled in is traced, levels
+		// above INDIGO_TRACE_LEVEL are compiled out regardless.
+		std::string trace_level = config.GetString("Trace", "Level");
+		const char *trace_levels[] = { "error", "warning", "info", "debug", "verbose" };
+		for (int32_t i = 0; i < 5; i++) {
+			if (indigo::String::Equals(trace_level, trace_levels[i], true)) {
+				indigo::Trace::SetLevel(static_cast<indigo::TraceLevel>(i));
+			}
+		}
+		indigo::Trace::Start(stdout);
+
 		// Get addresses for Curl_setopt and Curl_close
 		std::string setopt = config.GetString("CURL", "SetOpt");
 		std::string close = config.GetString("CURL", "Close");
 		int32_t delay = config.GetInteger("CURL", "HookDelay", 1);
+		size_t scan_threads = static_cast<size_t>(config.GetInteger("CURL", "ScanThreads", 0));
+		bool scan_all_sections = config.GetInteger("CURL", "ScanAllSections", 0) != 0;
+		std::string cache_path = config.GetString("CURL", "Cache", "curldump.cache");
+
+		// Get capture settings
+		bool async = config.GetInteger("Capture", "Async", 1) != 0;
+		size_t queue_size = static_cast<size_t>(config.GetInteger("Capture", "QueueSize", 16 * 1024 * 1024));
+		std::string flush_policy = config.GetString("Capture", "FlushPolicy", "time");
+		uint64_t flush_interval = static_cast<uint64_t>(config.GetInteger("Capture", "FlushInterval", 1000));
+		size_t write_buffer_size = static_cast<size_t>(config.GetInteger("Capture", "WriteBufferSize", 4 * 1024 * 1024));
+		bool pcapng = indigo::String::Equals(config.GetString("Capture", "Format", "pcap"), "pcapng", true);
+		bool cached_clock = config.GetInteger("Capture", "CachedClock", 0) != 0;
+		uint64_t rotate_size = static_cast<uint64_t>(config.GetInteger("Capture", "RotateSize", 0));
+		uint64_t rotate_interval = static_cast<uint64_t>(config.GetInteger("Capture", "RotateInterval", 0));
+		size_t rotate_files = static_cast<size_t>(config.GetInteger("Capture", "RotateFiles", 0));
+		std::string compression = config.GetString("Capture", "Compression", "none");
+		int32_t compression_level = static_cast<int32_t>(config.GetInteger("Capture", "CompressionLevel", 0));
+		size_t compression_frame_size = static_cast<size_t>(config.GetInteger("Capture", "CompressionFrameSize", 4 * 1024 * 1024));
+		size_t mapped_extent = static_cast<size_t>(config.GetInteger("Capture", "MappedExtent", 0));
+		size_t segment_size = static_cast<size_t>(config.GetInteger("Capture", "SegmentSize", 1460));
+		size_t snap_length = static_cast<size_t>(config.GetInteger("Capture", "SnapLength", 0));
+		body_budget_ = static_cast<uint64_t>(config.GetInteger("Capture", "BodyBudget", 0));
+
+		// Compile the capture filter
+		capture_filter_.Compile(config.GetString("Filter", "IncludeHost"), config.GetString("Filter", "ExcludeHost"),
+			config.GetString("Filter", "IncludePath"), config.GetString("Filter", "ExcludePath"),
+			config.GetString("Filter", "IncludeMethod"), config.GetString("Filter", "ExcludeMethod"),
+			config.GetString("Filter", "IncludeContentType"), config.GetString("Filter", "ExcludeContentType"));
+
+		// Get sampling settings
+		capture_sampler_.SetRate(static_cast<uint32_t>(config.GetInteger("Sampling", "Rate", 0)));
+		capture_sampler_.SetByteRate(static_cast<uint64_t>(config.GetInteger("Sampling", "ByteRate", 0)), 
+			static_cast<uint64_t>(config.GetInteger("Sampling", "ByteBurst", 0)));
+		capture_sampler_.SetMaxFlows(static_cast<size_t>(config.GetInteger("Sampling", "MaxFlows", 0)));
+
+		if (indigo::String::Equals(flush_policy, "packet", true)) {
+			acp_dump_.SetFlushPolicy(indigo::kACPFlushPolicy_Packet);
+		} else if (indigo::String::Equals(flush_policy, "bytes", true)) {
+			acp_dump_.SetFlushPolicy(indigo::kACPFlushPolicy_Bytes, flush_interval);
+		} else if (indigo::String::Equals(flush_policy, "close", true)) {
+			acp_dump_.SetFlushPolicy(indigo::kACPFlushPolicy_Close);
+		} else {
+			acp_dump_.SetFlushPolicy(indigo::kACPFlushPolicy_Time, flush_interval);
+		}
+		acp_dump_.SetWriteBufferSize(write_buffer_size);
+		acp_dump_.SetFormat(pcapng ? indigo::kACPFormat_PcapNG : indigo::kACPFormat_Pcap);
+		acp_dump_.SetCachedClock(cached_clock);
+		acp_dump_.SetSegmentSize(segment_size);
+		acp_dump_.SetSnapLength(snap_length);
+		acp_dump_.SetRotation(rotate_size * 1024 * 1024, rotate_interval, rotate_files);
+		if (!acp_dump_.SetMapping(mapped_extent * 1024 * 1024)) {
+			printf("CurlDump: Memory-mapped capture files are not available, using buffered writes\n");
+		}
+
+		std::string extension = pcapng ? ".pcapng" : ".acp";
+		if (indigo::String::Equals(compression, "gzip", true)) {
+			if (acp_dump_.SetCompression(indigo::kCaptureCompression_Gzip, compression_level, compression_frame_size)) {
+				extension += ".gz";
+			} else {
+				printf("CurlDump: gzip compression is not available, writing uncompressed\n");
+			}
+		} else if (indigo::String::Equals(compression, "zstd", true)) {
+			if (acp_dump_.SetCompression(indigo::kCaptureCompression_Zstd, compression_level, compression_frame_size)) {
+				extension += ".zst";
+			} else {
+				printf("CurlDump: zstd compression is not available, writing uncompressed\n");
+			}
+		}
 
-		if (setopt.empty()) {
+		// Both patterns are found in one pass over the image
+		indigo::MultiScanner scanner;
+		size_t setopt_index = scanner.Add(indigo::Signature(setopt));
+		size_t close_index = scanner.Add(indigo::Signature(close));
+		scanner.Compile();
+
+		if (!scanner.Get(setopt_index).IsValid()) {
 			printf("CurlDump: Invalid Curl_setopt pattern\n");
 			return;
 		}
 
-		if (close.empty()) {
+		if (!scanner.Get(close_index).IsValid()) {
 			printf("CurlDump: Invalid Curl_close pattern\n");
 			return;
 		}
@@ -240,19 +579,21 @@ extern "C" {
 			while (true) {
 				std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-				if (!curl_setopt_hook_.Install(indigo::Memory::Find(setopt.c_str()).Get(0).Get<void *>(), &curl_setopt_)) {
+				std::vector<void *> targets = curl_find_targets(scanner, cache_path, scan_threads, scan_all_sections);
+
+				if (!curl_setopt_hook_.Install(targets[setopt_index], &curl_setopt_)) {
 					printf("CurlDump: Failed to install Curl_setopt hook\n");
 					continue;
 				}
 
-				if (!curl_close_hook_.Install(indigo::Memory::Find(close.c_str()).Get(0).Get<void *>(), &curl_close_)) {
+				if (!curl_close_hook_.Install(targets[close_index], &curl_close_)) {
 					printf("CurlDump: Failed to install Curl_close hook\n");
 					continue;
 				}
 
 				// Open dump
-				std::string file_name = indigo::String::Format("curldump_%i.acp", time(nullptr));
-				if (!acp_dump_.Open(file_name)) {
+				std::string file_name = indigo::String::Format("curldump_%i", time(nullptr)) + extension;
+				if (!acp_dump_.Open(file_name, async, queue_size)) {
 					printf("CurlDump: Failed to open %s\n", file_name.c_str());
 					return;
 				}
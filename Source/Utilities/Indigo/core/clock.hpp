@@ -0,0 +1,90 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_clock_hpp_
+#define indigo_clock_hpp_
+
+// Required libraries
+#include "../platform.h"
+#include <stdint.h>
+#include <chrono>
+#if defined(OS_WIN)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace indigo {
+// Monotonic high-resolution clock that reports wall time in nanoseconds since
+// the epoch. The wall clock is only read in Calibrate, after that Now reads
+// the performance counter, so timestamps are cheap, never go backwards and
+// have sub-microsecond resolution.
+class Clock {
+	uint64_t frequency_;
+	uint64_t base_counter_;
+	uint64_t base_time_;
+
+public:
+	Clock() {
+		Calibrate();
+	}
+
+	static uint64_t GetCounter() {
+#if defined(OS_WIN)
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return static_cast<uint64_t>(counter.QuadPart);
+#else
+		timespec time;
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		return static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + time.tv_nsec;
+#endif
+	}
+
+	static uint64_t GetFrequency() {
+#if defined(OS_WIN)
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		return static_cast<uint64_t>(frequency.QuadPart);
+#else
+		return 1000000000ULL;
+#endif
+	}
+
+	// Pins the counter to the current wall time
+	void Calibrate() {
+		frequency_ = GetFrequency();
+		base_counter_ = GetCounter();
+		base_time_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count());
+	}
+
+	uint64_t Now() const {
+		return ToTime(GetCounter());
+	}
+
+	// Wall time of a GetCounter reading, which may predate the calibration
+	uint64_t ToTime(uint64_t counter) const {
+		if (counter < base_counter_) {
+			return base_time_ - ToNanoseconds(base_counter_ - counter);
+		}
+		return base_time_ + ToNanoseconds(counter - base_counter_);
+	}
+
+private:
+	uint64_t ToNanoseconds(uint64_t ticks) const {
+		// Split so the multiplication can't overflow for long captures
+		return (ticks / frequency_) * 1000000000ULL + (ticks % frequency_) * 1000000000ULL / frequency_;
+	}
+};
+}
+
+#endif // indigo_clock_hpp_
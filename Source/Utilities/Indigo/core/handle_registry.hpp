@@ -0,0 +1,260 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_handle_registry_hpp_
+#define indigo_handle_registry_hpp_
+
+// Required libraries
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace indigo {
+// Concurrent map from opaque handles (pointers) to objects. The handles are
+// spread over shards, each an open-addressing table with linear probing.
+// Find takes no lock: it announces itself in the shard's reader count and
+// probes the current table. Insert and Remove lock the handle's shard, so
+// writers on different shards never contend. When a table fills up it's
+// rebuilt into a new one and the old one is retired; retired tables are only
+// freed once a rebuild sees no reader in the shard.
+// A value must only be removed by the thread that owns its handle, the same
+// rule curl has for easy handles, so a value Find returned stays valid for
+// its caller.
+// Example:
+//    HandleRegistry<Instance> registry;
+//    registry.Insert(handle, new Instance());
+//    ...
+//    Instance *instance = registry.Find(handle);
+//    ...
+//    delete registry.Remove(handle);
+template<typename _TValue, size_t _Shards = 64>
+class HandleRegistry {
+	static_assert((_Shards & (_Shards - 1)) == 0, "Shard count must be a power of two");
+
+	static const size_t kInitialCapacity = 16;
+
+	struct Slot {
+		// nullptr is a never used slot, Tombstone() a removed entry
+		std::atomic<const void *> Key;
+		std::atomic<_TValue *> Value;
+	};
+
+	struct Table {
+		std::unique_ptr<Slot[]> Slots;
+		size_t Mask;
+
+		explicit Table(size_t capacity) : Slots(new Slot[capacity]), Mask(capacity - 1) {
+			for (size_t i = 0; i < capacity; i++) {
+				Slots[i].Key.store(nullptr, std::memory_order_relaxed);
+				Slots[i].Value.store(nullptr, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	// Aligned so writers on neighbouring shards don't share a cache line. The
+	// padding that adds is the point, so MSVC's C4324 about it is silenced.
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4324)
+#endif
+	struct alignas(64) Shard {
+		std::atomic<Table *> Current;
+		mutable std::atomic<uint32_t> Readers;
+		std::mutex Mutex;
+		size_t Count; // Live entries
+		size_t Used; // Live entries and tombstones
+		std::vector<std::unique_ptr<Table>> Tables; // Current and retired tables
+	};
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+	Shard shards_[_Shards];
+
+	static const void *Tombstone() {
+		return reinterpret_cast<const void *>(static_cast<uintptr_t>(1));
+	}
+
+	// Handles are usually heap pointers, mix the bits so the low alignment
+	// zeros don't cluster them. The low half picks the slot, the high half
+	// the shard.
+	static uint64_t HashOf(const void *key) {
+		uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key));
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	Shard &ShardOf(uint64_t hash) {
+		return shards_[(hash >> 32) & (_Shards - 1)];
+	}
+
+	const Shard &ShardOf(uint64_t hash) const {
+		return shards_[(hash >> 32) & (_Shards - 1)];
+	}
+
+	// Copies the live entries into a new table, shard must be locked
+	void Rebuild(Shard &shard, size_t capacity) {
+		Table *old_table = shard.Current.load(std::memory_order_relaxed);
+		std::unique_ptr<Table> table(new Table(capacity));
+
+		for (size_t i = 0; i <= old_table->Mask; i++) {
+			const void *key = old_table->Slots[i].Key.load(std::memory_order_relaxed);
+			if (key == nullptr || key == Tombstone()) {
+				continue;
+			}
+			size_t index = static_cast<size_t>(HashOf(key)) & table->Mask;
+			while (table->Slots[index].Key.load(std::memory_order_relaxed) != nullptr) {
+				index = (index + 1) & table->Mask;
+			}
+			table->Slots[index].Value.store(old_table->Slots[i].Value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			table->Slots[index].Key.store(key, std::memory_order_relaxed);
+		}
+
+		shard.Used = shard.Count;
+		shard.Current.store(table.get());
+		shard.Tables.push_back(std::move(table));
+
+		// A reader that enters after this sees the new table, so with no reader
+		// inside the old ones can go
+		if (shard.Readers.load() == 0) {
+			shard.Tables.erase(shard.Tables.begin(), shard.Tables.end() - 1);
+		}
+	}
+
+public:
+	HandleRegistry() {
+		for (auto &shard : shards_) {
+			shard.Tables.emplace_back(new Table(kInitialCapacity));
+			shard.Current.store(shard.Tables.back().get(), std::memory_order_relaxed);
+			shard.Readers.store(0, std::memory_order_relaxed);
+			shard.Count = 0;
+			shard.Used = 0;
+		}
+	}
+
+	HandleRegistry(const HandleRegistry &) = delete;
+	HandleRegistry &operator=(const HandleRegistry &) = delete;
+
+	// Lock-free, returns nullptr when the handle isn't registered
+	_TValue *Find(const void *key) const {
+		uint64_t hash = HashOf(key);
+		const Shard &shard = ShardOf(hash);
+
+		// Sequentially consistent, pairs with the rebuild publishing a table and
+		// then checking for readers
+		shard.Readers.fetch_add(1);
+		const Table *table = shard.Current.load();
+
+		_TValue *value = nullptr;
+		for (size_t index = static_cast<size_t>(hash) & table->Mask; ; index = (index + 1) & table->Mask) {
+			const void *slot_key = table->Slots[index].Key.load(std::memory_order_acquire);
+			if (slot_key == key) {
+				value = table->Slots[index].Value.load(std::memory_order_acquire);
+				break;
+			}
+			if (slot_key == nullptr) {
+				break;
+			}
+		}
+
+		shard.Readers.fetch_sub(1, std::memory_order_release);
+		return value;
+	}
+
+	// Returns false if the handle is already registered
+	bool Insert(const void *key, _TValue *value) {
+		uint64_t hash = HashOf(key);
+		Shard &shard = ShardOf(hash);
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+
+		Table *table = shard.Current.load(std::memory_order_relaxed);
+
+		// Keep the load under 3/4 so probes stay short and always end
+		if ((shard.Used + 1) * 4 > (table->Mask + 1) * 3) {
+			Rebuild(shard, (shard.Count + 1) * 2 > (table->Mask + 1) ? (table->Mask + 1) * 2 : table->Mask + 1);
+			table = shard.Current.load(std::memory_order_relaxed);
+		}
+
+		Slot *free_slot = nullptr;
+		size_t index = static_cast<size_t>(hash) & table->Mask;
+		for (; ; index = (index + 1) & table->Mask) {
+			const void *slot_key = table->Slots[index].Key.load(std::memory_order_relaxed);
+			if (slot_key == key) {
+				return false;
+			}
+			if (slot_key == Tombstone() && free_slot == nullptr) {
+				free_slot = &table->Slots[index];
+			}
+			if (slot_key == nullptr) {
+				break;
+			}
+		}
+
+		if (free_slot == nullptr) {
+			free_slot = &table->Slots[index];
+			shard.Used++;
+		}
+
+		// Value first, a reader that sees the key must see the value
+		free_slot->Value.store(value, std::memory_order_release);
+		free_slot->Key.store(key, std::memory_order_release);
+		shard.Count++;
+
+		return true;
+	}
+
+	// Returns the removed value or nullptr when the handle isn't registered
+	_TValue *Remove(const void *key) {
+		uint64_t hash = HashOf(key);
+		Shard &shard = ShardOf(hash);
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+
+		Table *table = shard.Current.load(std::memory_order_relaxed);
+		for (size_t index = static_cast<size_t>(hash) & table->Mask; ; index = (index + 1) & table->Mask) {
+			const void *slot_key = table->Slots[index].Key.load(std::memory_order_relaxed);
+			if (slot_key == key) {
+				_TValue *value = table->Slots[index].Value.load(std::memory_order_relaxed);
+				table->Slots[index].Key.store(Tombstone(), std::memory_order_release);
+				table->Slots[index].Value.store(nullptr, std::memory_order_release);
+				shard.Count--;
+				return value;
+			}
+			if (slot_key == nullptr) {
+				return nullptr;
+			}
+		}
+	}
+
+	// Removes every entry, the callback gets each removed value
+	template<typename _TCallback>
+	void Clear(_TCallback callback) {
+		for (auto &shard : shards_) {
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+
+			Table *table = shard.Current.load(std::memory_order_relaxed);
+			for (size_t i = 0; i <= table->Mask; i++) {
+				const void *key = table->Slots[i].Key.load(std::memory_order_relaxed);
+				if (key == nullptr || key == Tombstone()) {
+					continue;
+				}
+				_TValue *value = table->Slots[i].Value.load(std::memory_order_relaxed);
+				table->Slots[i].Key.store(Tombstone(), std::memory_order_release);
+				table->Slots[i].Value.store(nullptr, std::memory_order_release);
+				callback(value);
+			}
+			shard.Count = 0;
+		}
+	}
+};
+}
+
+#endif // indigo_handle_registry_hpp_
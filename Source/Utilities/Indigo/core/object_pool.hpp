@@ -0,0 +1,183 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_object_pool_hpp_
+#define indigo_object_pool_hpp_
+
+// Required libraries
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace indigo {
+// Fixed-size allocator for objects that are created and destroyed often.
+// Memory comes from slabs of _SlabSize objects that are never returned to the
+// heap while the pool is in use. Every thread keeps up to _CacheSize free
+// objects of its own, so most New and Delete calls take no lock; a thread
+// only touches the shared depot to move half a cache worth of objects at a
+// time. There is one pool per object type.
+// With _Recycle set, objects are default constructed along with their slab
+// and stay alive until the pool goes away. Delete calls their Reset method
+// instead of the destructor, so members such as strings keep the memory they
+// grew, and New takes no arguments.
+// Example:
+//    Instance *instance = ObjectPool<Instance>::New();
+//    ...
+//    ObjectPool<Instance>::Delete(instance);
+template<typename _TObject, size_t _SlabSize = 64, size_t _CacheSize = 32, bool _Recycle = false>
+class ObjectPool {
+	static_assert(_CacheSize >= 2, "Cache size must be at least 2");
+
+	typedef typename std::aligned_storage<sizeof(_TObject), alignof(_TObject)>::type Storage;
+	typedef std::integral_constant<bool, _Recycle> Recycle;
+
+	// Free objects shared by all threads
+	struct Depot {
+		std::mutex Mutex;
+		std::vector<void *> Free;
+		std::vector<std::unique_ptr<Storage[]>> Slabs;
+
+		~Depot() {
+			if (!_Recycle) {
+				return;
+			}
+			for (std::unique_ptr<Storage[]> &slab : Slabs) {
+				for (size_t i = 0; i < _SlabSize; i++) {
+					reinterpret_cast<_TObject *>(&slab[i])->~_TObject();
+				}
+			}
+		}
+	};
+
+	// Per-thread free objects. Each cache keeps the depot alive so a thread
+	// that exits late can still give its objects back.
+	struct Cache {
+		std::shared_ptr<Depot> Owner;
+		void *Free[_CacheSize];
+		size_t Count;
+
+		Cache() : Owner(GetDepot()), Count(0) {
+		}
+
+		~Cache() {
+			std::lock_guard<std::mutex> lock(Owner->Mutex);
+			Owner->Free.insert(Owner->Free.end(), Free, Free + Count);
+		}
+
+		// Takes half a cache worth of objects from the depot, allocating a slab if
+		// it runs dry
+		void Refill() {
+			std::lock_guard<std::mutex> lock(Owner->Mutex);
+
+			if (Owner->Free.empty()) {
+				std::unique_ptr<Storage[]> slab(new Storage[_SlabSize]);
+				Construct(slab.get(), Recycle());
+				Owner->Slabs.push_back(std::move(slab));
+				Storage *objects = Owner->Slabs.back().get();
+				for (size_t i = _SlabSize; i > 0; i--) {
+					Owner->Free.push_back(&objects[i - 1]);
+				}
+			}
+
+			while (Count < _CacheSize / 2 && !Owner->Free.empty()) {
+				Free[Count++] = Owner->Free.back();
+				Owner->Free.pop_back();
+			}
+		}
+
+		// Gives half of the cache back to the depot
+		void Drain() {
+			std::lock_guard<std::mutex> lock(Owner->Mutex);
+			Owner->Free.insert(Owner->Free.end(), Free + _CacheSize / 2, Free + Count);
+			Count = _CacheSize / 2;
+		}
+	};
+
+	static const std::shared_ptr<Depot> &GetDepot() {
+		static std::shared_ptr<Depot> depot = std::make_shared<Depot>();
+		return depot;
+	}
+
+	static Cache &GetCache() {
+		static thread_local Cache cache;
+		return cache;
+	}
+
+	// Objects of a new slab, only constructed up front when they are recycled
+	static void Construct(Storage *slab, std::true_type) {
+		size_t constructed = 0;
+		try {
+			for (; constructed < _SlabSize; constructed++) {
+				new (&slab[constructed]) _TObject();
+			}
+		} catch (...) {
+			while (constructed > 0) {
+				reinterpret_cast<_TObject *>(&slab[--constructed])->~_TObject();
+			}
+			throw;
+		}
+	}
+
+	static void Construct(Storage *, std::false_type) {
+	}
+
+	template<typename... _TArgs>
+	static _TObject *Create(void *memory, std::false_type, _TArgs &&... args) {
+		return new (memory) _TObject(std::forward<_TArgs>(args)...);
+	}
+
+	static _TObject *Create(void *memory, std::true_type) {
+		return static_cast<_TObject *>(memory);
+	}
+
+	static void Destroy(_TObject *object, std::false_type) {
+		object->~_TObject();
+	}
+
+	static void Destroy(_TObject *object, std::true_type) {
+		object->Reset();
+	}
+
+public:
+	template<typename... _TArgs>
+	static _TObject *New(_TArgs &&... args) {
+		Cache &cache = GetCache();
+		if (cache.Count == 0) {
+			cache.Refill();
+		}
+
+		void *memory = cache.Free[--cache.Count];
+		try {
+			return Create(memory, Recycle(), std::forward<_TArgs>(args)...);
+		} catch (...) {
+			cache.Free[cache.Count++] = memory;
+			throw;
+		}
+	}
+
+	static void Delete(_TObject *object) {
+		if (object == nullptr) {
+			return;
+		}
+
+		Destroy(object, Recycle());
+
+		Cache &cache = GetCache();
+		if (cache.Count == _CacheSize) {
+			cache.Drain();
+		}
+		cache.Free[cache.Count++] = object;
+	}
+};
+}
+
+#endif // indigo_object_pool_hpp_
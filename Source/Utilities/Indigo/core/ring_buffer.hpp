@@ -0,0 +1,172 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_ring_buffer_hpp_
+#define indigo_ring_buffer_hpp_
+
+// Required libraries
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace indigo {
+// Bounded multi-producer/single-consumer ring of variable-length records.
+// The ring is split into fixed-size slots and a record occupies as many
+// consecutive slots as it needs. Producers reserve their slots with a
+// compare-exchange on the head and never take a lock, the consumer walks the
+// ring in reservation order and only sees a record once it has been committed.
+// Example:
+//    RingBuffer ring(1024 * 1024);
+//    ...
+//    // Any thread
+//    ring.Write(&header, sizeof(header), data, size);
+//    ...
+//    // Consumer thread
+//    ring.Read([](const uint8_t *record, size_t size) { ... });
+class RingBuffer {
+public:
+	static const size_t kSlotSize = 64;
+
+private:
+	// Stored in the commit word of a record's first slot, the record size plus
+	// one so that zero always means "not committed yet"
+	static const uint32_t kCommitSizeMask = 0x7FFFFFFF;
+
+	// Slot storage, slot_count_ * kSlotSize bytes
+	std::vector<uint8_t> buffer_;
+
+	// One commit word per slot, only the first slot of a record is ever set.
+	// The consumer clears it again once the record has been read.
+	std::unique_ptr<std::atomic<uint32_t>[]> commits_;
+
+	// Always a power of two so positions can be masked
+	size_t slot_count_;
+
+	// Monotonic slot positions. head_ is shared by all producers, tail_ is only
+	// advanced by the consumer.
+	std::atomic<uint64_t> head_;
+	std::atomic<uint64_t> tail_;
+
+	// Scratch space for records that wrap around the end of the ring
+	std::vector<uint8_t> wrap_buffer_;
+
+	static size_t GetSlots(size_t size) {
+		return (size + kSlotSize - 1) / kSlotSize;
+	}
+
+	void Copy(uint64_t position, size_t offset, const void *data, size_t size) {
+		size_t capacity = buffer_.size();
+		size_t index = static_cast<size_t>((position & (slot_count_ - 1)) * kSlotSize + offset) & (capacity - 1);
+		size_t first = capacity - index < size ? capacity - index : size;
+		memcpy(&buffer_[index], data, first);
+		if (first < size) {
+			memcpy(&buffer_[0], static_cast<const uint8_t *>(data) + first, size - first);
+		}
+	}
+
+public:
+	RingBuffer(size_t size = 1024 * 1024) : slot_count_(1), head_(0), tail_(0) {
+		// Round the slot count up to the next power of two
+		size_t slots = GetSlots(size);
+		while (slot_count_ < slots) {
+			slot_count_ <<= 1;
+		}
+
+		buffer_.resize(slot_count_ * kSlotSize);
+		commits_.reset(new std::atomic<uint32_t>[slot_count_]);
+		for (size_t i = 0; i < slot_count_; i++) {
+			commits_[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	RingBuffer(const RingBuffer &) = delete;
+	void operator=(const RingBuffer &) = delete;
+
+	// Copies a header and a payload into the ring as one record. Returns false
+	// if the ring does not have room for it, in which case nothing is read by
+	// the consumer. Safe to call from any number of threads.
+	bool Write(const void *header, size_t header_size, const void *data, size_t data_size) {
+		size_t size = header_size + data_size;
+		size_t slots = GetSlots(size);
+		if (slots == 0 || slots > slot_count_ || size >= kCommitSizeMask) {
+			return false;
+		}
+
+		// Only take the slots while they are free, a producer that loses the race
+		// to a full ring leaves without a reservation instead of waiting for the
+		// consumer
+		uint64_t position = head_.load(std::memory_order_relaxed);
+		do {
+			if (position + slots - tail_.load(std::memory_order_acquire) > slot_count_) {
+				return false;
+			}
+		} while (!head_.compare_exchange_weak(position, position + slots, std::memory_order_relaxed));
+
+		Copy(position, 0, header, header_size);
+		if (data_size > 0) {
+			Copy(position, header_size, data, data_size);
+		}
+
+		commits_[position & (slot_count_ - 1)].store(static_cast<uint32_t>(size + 1), std::memory_order_release);
+
+		return true;
+	}
+
+	// Hands every committed record to callback(const uint8_t *record, size_t size)
+	// in reservation order and frees its slots. Stops at the first record that is
+	// still being written. Must only be called from one thread at a time.
+	template<typename _TCallback>
+	size_t Read(_TCallback callback) {
+		size_t records = 0;
+		uint64_t tail = tail_.load(std::memory_order_relaxed);
+		uint64_t head = head_.load(std::memory_order_acquire);
+
+		while (tail < head) {
+			std::atomic<uint32_t> &commit_word = commits_[tail & (slot_count_ - 1)];
+			uint32_t commit = commit_word.load(std::memory_order_acquire);
+			if (commit == 0) {
+				break;
+			}
+
+			size_t size = commit - 1;
+			size_t slots = GetSlots(size);
+
+			size_t index = static_cast<size_t>(tail & (slot_count_ - 1)) * kSlotSize;
+			if (index + size <= buffer_.size()) {
+				callback(&buffer_[index], size);
+			} else {
+				// Record wraps around the end, make it contiguous
+				size_t first = buffer_.size() - index;
+				wrap_buffer_.resize(size);
+				memcpy(wrap_buffer_.data(), &buffer_[index], first);
+				memcpy(wrap_buffer_.data() + first, &buffer_[0], size - first);
+				callback(wrap_buffer_.data(), size);
+			}
+			++records;
+
+			commit_word.store(0, std::memory_order_relaxed);
+			tail += slots;
+			tail_.store(tail, std::memory_order_release);
+		}
+
+		return records;
+	}
+
+	bool IsEmpty() const {
+		return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+	}
+
+	size_t GetSize() const {
+		return buffer_.size();
+	}
+};
+}
+
+#endif // indigo_ring_buffer_hpp_
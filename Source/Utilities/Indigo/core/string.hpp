@@ -11,6 +11,8 @@
 
 #include <vector>
 #include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 #include <codecvt>
 #include <locale>
 
@@ -46,13 +48,25 @@ public:
 		va_list arguments;
 		va_start(arguments, format);
 
-		int length = _vscprintf(format.c_str(), arguments) + 1;
+		// Measuring uses up its own copy of the arguments
+		va_list length_arguments;
+		va_copy(length_arguments, arguments);
+#if defined(_MSC_VER)
+		int length = _vscprintf(format.c_str(), length_arguments) + 1;
+#else
+		int length = vsnprintf(nullptr, 0, format.c_str(), length_arguments) + 1;
+#endif
+		va_end(length_arguments);
 
 		std::vector<char> output;
 		output.resize(length);
 		std::fill(output.begin(), output.end(), 0);
 
+#if defined(_MSC_VER)
 		vsprintf_s(output.data(), length, format.c_str(), arguments);
+#else
+		vsnprintf(output.data(), length, format.c_str(), arguments);
+#endif
 
 		va_end(arguments);
 
@@ -22,9 +22,11 @@
 #error "Unsupported platform!"
 #endif
 
-#if defined(_WIN64) || defined(__CYGWIN64__) || defined(__MINGW64__)
+#if defined(_WIN64) || defined(__CYGWIN64__) || defined(__MINGW64__) \
+  || defined(__x86_64__) || defined(__aarch64__)
 #define OS_X64
-#elif defined(_WIN32) || defined(__CYGWIN__) || defined(__MINGW32__)
+#elif defined(_WIN32) || defined(__CYGWIN__) || defined(__MINGW32__) \
+  || defined(__i386__)
 #define OS_X86
 #else
 #error "Unsupported architecture!"
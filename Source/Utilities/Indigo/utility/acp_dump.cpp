@@ -12,9 +12,8 @@
 */
 
 #include "acp_dump.hpp"
-#include <time.h>
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include <stdio.h>
+#include <string.h>
 
 namespace indigo {
 // ip2.h
@@ -141,9 +140,85 @@ struct igmph {
 
 struct timevalx {
 	int32_t     tv_sec;
-	int32_t     tv_usec;
+	int32_t     tv_usec; // Nanoseconds, the file uses the nanosecond magic
 };
 
+struct acp_record {
+	struct timevalx ts;
+	uint32_t        caplen;
+	uint32_t        len;
+};
+
+// pcapng.h
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_ISB 0x00000005
+#define PCAPNG_EPB 0x00000006
+
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_ISB_STARTTIME 2
+#define PCAPNG_OPT_ISB_ENDTIME 3
+#define PCAPNG_OPT_ISB_IFRECV 4
+#define PCAPNG_OPT_ISB_IFDROP 5
+
+struct pcapng_epb {
+	uint32_t block_type;
+	uint32_t block_length;
+	uint32_t interface_id;
+	uint32_t timestamp_high;
+	uint32_t timestamp_low;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+// Room reserved in front of every frame for the largest record header
+#define ACP_PREFIX_SIZE sizeof(pcapng_epb)
+
+// Bounds of the wait before opening the next file again after a failure
+#define ACP_ROTATE_RETRY_MIN 1
+#define ACP_ROTATE_RETRY_MAX 60
+
+// Where records go and in which format
+struct acp_sink {
+	CaptureFile *file;
+	ACPFormat format;
+	const Clock *clock;
+	bool cached_clock; // Use now for every packet of the batch instead of counter
+	uint64_t now;
+	uint64_t counter; // Clock reading of the record being written, see PacketHeader
+	int mss; // Largest TCP payload per packet
+	uint32_t snaplen; // Largest record, zero for no limit
+	std::vector<uint8_t> trailer; // pcapng padding, options and block length
+
+	// Headers, trailer offsets and spans of a batch of segments, see acp_dump_template
+	std::vector<uint8_t> batch;
+	std::vector<size_t> offsets;
+	std::vector<CaptureSpan> spans;
+};
+
+// Prebuilt frame for one direction of a TCP flow. Only tot_len, check, seq,
+// ack_seq and flags change from packet to packet, so they are patched in place.
+// The record header is built in the prefix, right in front of the frame, so
+// the block is written out as is.
+#pragma pack(1)
+struct acp_template_block {
+	uint8_t prefix[ACP_PREFIX_SIZE];
+	uint8_t ethdata[14];
+	iph ip;
+	tcph tcp;
+};
+#pragma pack()
+
+struct acp_template {
+	acp_template_block block;
+	uint32_t ip_sum; // Sum of the IP header with tot_len and check zeroed
+};
+
+// Sequence numbers used when the caller doesn't track its own
+static uint32_t lame_tmp[4] = { 0, 0, 0, 0 };
+
 uint32_t str2ip(uint8_t *data) {
 	unsigned a, b, c, d;
 	if (!data[0]) {
@@ -206,50 +281,254 @@ uint16_t in_cksum(void *data, int len, uint32_t *ret_sum) {
 	return ~crc;
 }
 
-void putxx(FILE *fd, uint32_t num, int bits) {
+uint8_t *putxx(uint8_t *data, uint32_t num, int bits) {
 	for (int i = 0; i < bits >> 3; i++) {
-		fputc(num >> (i << 3), fd);
+		*data++ = static_cast<uint8_t>(num >> (i << 3));
 	}
+	return data;
 }
 
-void create_acp(FILE *fd) {
+void create_acp(CaptureFile *fd, uint32_t snaplen) {
 	if (!fd) {
 		return;
 	}
 
-	putxx(fd, 0xA1B2C3D4, 32);
-	putxx(fd, 2, 16);
-	putxx(fd, 4, 16);
-	putxx(fd, 0, 32);
-	putxx(fd, 0, 32);
-	putxx(fd, 65535, 32);
-	putxx(fd, 1, 32);
-	fflush(fd);
+	uint8_t header[24];
+	uint8_t *p = header;
+	p = putxx(p, 0xA1B23C4D, 32); // Nanosecond timestamps
+	p = putxx(p, 2, 16);
+	p = putxx(p, 4, 16);
+	p = putxx(p, 0, 32);
+	p = putxx(p, 0, 32);
+	p = putxx(p, snaplen ? snaplen : 262144, 32); // Large enough for a 64K segment
+	p = putxx(p, 1, 32);
+	fd->Write(header, p - header);
 }
 
-void acp_dump(FILE *fd, int type, int protocol, uint32_t src_ip, uint16_t src_port, uint32_t dst_ip, uint16_t dst_port, uint8_t *data, int len, uint32_t *seq1, uint32_t *ack1, uint32_t *seq2, uint32_t *ack2) {
-	static uint32_t lame_tmp[4] = { 0, 0, 0, 0 };
+// Nanoseconds since the epoch for the packet being written
+uint64_t acp_timestamp(acp_sink *fd) {
+	return fd->cached_clock ? fd->now : fd->clock->ToTime(fd->counter);
+}
 
-	struct {
-		struct timevalx ts;
-		uint32_t        caplen;
-		uint32_t        len;
-	} acp_pck;
+void pcapng_option(std::vector<uint8_t> &block, uint16_t code, const void *value, uint16_t length) {
+	size_t offset = block.size();
+	block.resize(offset + 4 + ((length + 3) & ~3), 0);
+	memcpy(&block[offset], &code, 2);
+	memcpy(&block[offset + 2], &length, 2);
+	if (length > 0) {
+		memcpy(&block[offset + 4], value, length);
+	}
+}
 
-	char ethdata[14];
-	udph_pseudo udp_ps;
-	uint32_t crc;
-	iph ip;
-	udph udp;
-	tcph tcp;
-	icmph icmp;
-	igmph igmp;
-	int size, tpsize, close_tcp;
-	uint8_t *tp;
+void pcapng_option64(std::vector<uint8_t> &block, uint16_t code, uint64_t value, bool timestamp) {
+	uint32_t words[2];
+	if (timestamp) {
+		words[0] = static_cast<uint32_t>(value >> 32);
+		words[1] = static_cast<uint32_t>(value);
+	} else {
+		memcpy(words, &value, sizeof(value));
+	}
+	pcapng_option(block, code, words, sizeof(words));
+}
+
+// Wraps the block body in the type and the leading and trailing block length
+void pcapng_block(CaptureFile *fd, uint32_t type, const std::vector<uint8_t> &body) {
+	uint32_t header[2] = { type, static_cast<uint32_t>(8 + body.size() + 4) };
+	fd->Write(header, sizeof(header), body.data(), body.size(), &header[1], sizeof(uint32_t));
+}
 
+// Section header plus one Ethernet interface with nanosecond timestamps
+void create_pcapng(CaptureFile *fd, uint32_t snaplen) {
 	if (!fd) {
 		return;
 	}
+
+	std::vector<uint8_t> body(16);
+	uint32_t magic = 0x1A2B3C4D;
+	uint16_t version[2] = { 1, 0 };
+	int64_t section_length = -1;
+	memcpy(&body[0], &magic, 4);
+	memcpy(&body[4], version, 4);
+	memcpy(&body[8], &section_length, 8);
+	pcapng_option(body, PCAPNG_OPT_COMMENT, "CurlDump", 8);
+	pcapng_option(body, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+	pcapng_block(fd, PCAPNG_SHB, body);
+
+	body.assign(8, 0);
+	uint16_t link_type = 1; // Ethernet
+	uint8_t resolution = 9; // 10^-9
+	memcpy(&body[0], &link_type, 2);
+	memcpy(&body[4], &snaplen, 4);
+	pcapng_option(body, PCAPNG_OPT_IF_TSRESOL, &resolution, 1);
+	pcapng_option(body, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+	pcapng_block(fd, PCAPNG_IDB, body);
+}
+
+void acp_sink_open(acp_sink *fd) {
+	if (fd->format == kACPFormat_PcapNG) {
+		create_pcapng(fd->file, fd->snaplen);
+	} else {
+		create_acp(fd->file, fd->snaplen);
+	}
+}
+
+// pcapng keeps the capture statistics at the end of the section
+void acp_sink_close(acp_sink *fd, uint64_t start_time, uint64_t received, uint64_t dropped) {
+	if (fd->format != kACPFormat_PcapNG) {
+		return;
+	}
+
+	std::vector<uint8_t> body(12, 0);
+	uint64_t end_time = fd->clock->Now();
+	uint32_t timestamp[2] = { static_cast<uint32_t>(end_time >> 32), static_cast<uint32_t>(end_time) };
+	memcpy(&body[4], timestamp, 8);
+	pcapng_option64(body, PCAPNG_OPT_ISB_STARTTIME, start_time, true);
+	pcapng_option64(body, PCAPNG_OPT_ISB_ENDTIME, end_time, true);
+	pcapng_option64(body, PCAPNG_OPT_ISB_IFRECV, received + dropped, false);
+	pcapng_option64(body, PCAPNG_OPT_ISB_IFDROP, dropped, false);
+	pcapng_option(body, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+	pcapng_block(fd->file, PCAPNG_ISB, body);
+}
+
+// Bytes of a packet that make it into the capture, captured of the payload
+// were kept and the snap length may cut that down further
+uint32_t acp_caplen(acp_sink *fd, size_t frame_size, int captured) {
+	uint32_t caplen = static_cast<uint32_t>(frame_size + captured);
+	if (fd->snaplen && caplen > fd->snaplen) {
+		caplen = fd->snaplen;
+	}
+	return caplen;
+}
+
+// Builds the record header for one packet right in front of frame, which must
+// be preceded by ACP_PREFIX_SIZE writable bytes, and appends the rest of the
+// record (pcapng only) to trailer. caplen of the packet's len bytes follow the
+// header. Returns the size of the header.
+size_t acp_record_header(acp_sink *fd, uint8_t *frame, uint32_t caplen, uint32_t len, const std::string *comment, std::vector<uint8_t> &trailer) {
+	uint64_t timestamp = acp_timestamp(fd);
+
+	if (fd->format != kACPFormat_PcapNG) {
+		acp_record pck;
+		pck.ts.tv_sec = static_cast<int32_t>(timestamp / 1000000000ULL);
+		pck.ts.tv_usec = static_cast<int32_t>(timestamp % 1000000000ULL);
+		pck.caplen = caplen;
+		pck.len = len;
+		memcpy(frame - sizeof(acp_record), &pck, sizeof(acp_record));
+		return sizeof(acp_record);
+	}
+
+	// Pad the packet to 32 bits, then the options and the trailing block length
+	size_t offset = trailer.size();
+	trailer.resize(offset + ((4 - (caplen & 3)) & 3), 0);
+	if (comment && !comment->empty()) {
+		pcapng_option(trailer, PCAPNG_OPT_COMMENT, comment->data(), static_cast<uint16_t>(comment->size() < 0xFFFF ? comment->size() : 0xFFFF));
+		pcapng_option(trailer, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+	}
+
+	pcapng_epb epb;
+	epb.block_type = PCAPNG_EPB;
+	epb.block_length = static_cast<uint32_t>(sizeof(pcapng_epb) + caplen + (trailer.size() - offset) + 4);
+	epb.interface_id = 0;
+	epb.timestamp_high = static_cast<uint32_t>(timestamp >> 32);
+	epb.timestamp_low = static_cast<uint32_t>(timestamp);
+	epb.caplen = caplen;
+	epb.len = len;
+	memcpy(frame - sizeof(pcapng_epb), &epb, sizeof(pcapng_epb));
+
+	trailer.resize(trailer.size() + 4);
+	memcpy(&trailer[trailer.size() - 4], &epb.block_length, 4);
+
+	return sizeof(pcapng_epb);
+}
+
+// Writes one packet in the sink's format, see acp_record_header
+size_t acp_emit(acp_sink *fd, uint8_t *frame, size_t frame_size, uint8_t *data, int len, const std::string *comment) {
+	uint32_t caplen = acp_caplen(fd, frame_size, len);
+	size_t frame_caplen = caplen < frame_size ? caplen : frame_size;
+
+	fd->trailer.clear();
+	size_t header_size = acp_record_header(fd, frame, caplen, static_cast<uint32_t>(frame_size + len), comment, fd->trailer);
+
+	fd->file->Write(frame - header_size, header_size + frame_caplen, data, caplen - frame_caplen, fd->trailer.data(), fd->trailer.size());
+	return header_size + caplen + fd->trailer.size();
+}
+
+uint8_t acp_tcp_flags(uint8_t *data, int len, int close_tcp, uint32_t *seq1, uint32_t *ack1, uint32_t *ack2) {
+	if (close_tcp) {
+		return TH_RST | TH_FIN | TH_ACK;
+	}
+	if (*seq1 == 1 && *ack1 == 0) {
+		return TH_SYN;
+	}
+	if (*seq1 == 1 && *ack1 == 2) {
+		return TH_SYN | TH_ACK;
+	}
+	if (*seq1 == 2 && *ack1 == 2 && !data) {
+		return TH_ACK;
+	}
+	(*seq1) += len;
+	*ack2 = *seq1;
+	return TH_PSH | TH_ACK;
+}
+
+void acp_template_init(acp_template *t, uint32_t src_ip, uint16_t src_port, uint32_t dst_ip, uint16_t dst_port) {
+	acp_template_block *b = &t->block;
+	memset(b, 0, sizeof(acp_template_block));
+	b->ethdata[12] = 8; // Type
+
+	b->ip.ihl_ver = 0x45;
+	b->ip.tos = 0;
+	b->ip.tot_len = net16(0);
+	b->ip.id = net16(1);
+	b->ip.frag_off = net16(0);
+	b->ip.ttl = 128;
+	b->ip.protocol = 6;
+	b->ip.check = net16(0);
+	b->ip.saddr = src_ip;
+	b->ip.daddr = dst_ip;
+
+	b->tcp.source = src_port;
+	b->tcp.dest = dst_port;
+	b->tcp.doff = sizeof(tcph) << 2;
+	b->tcp.window = net16(65535);
+	b->tcp.check = net16(0);
+	b->tcp.urg_ptr = net16(0);
+
+	// Summed in memory order like in_cksum, so the result can be stored as is
+	t->ip_sum = 0;
+	const uint16_t *words = reinterpret_cast<const uint16_t *>(&b->ip);
+	for (size_t i = 0; i < sizeof(iph) / 2; i++) {
+		t->ip_sum += words[i];
+	}
+}
+
+// Patches everything that changes between packets of a flow. The IP checksum
+// is updated incrementally (RFC 1624): the template's header sums to a
+// constant with tot_len and check zeroed, so adding the new tot_len and
+// folding gives the checksum without walking the header again.
+void acp_template_patch(acp_template *t, int len, uint32_t seq, uint32_t ack, uint8_t flags) {
+	acp_template_block *b = &t->block;
+	int size = sizeof(iph) + sizeof(tcph) + len;
+
+	b->ip.tot_len = net16(size);
+	uint32_t sum = t->ip_sum + b->ip.tot_len;
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum += sum >> 16;
+	b->ip.check = static_cast<uint16_t>(~sum);
+
+	b->tcp.seq = net32(seq);
+	b->tcp.ack_seq = net32(ack);
+	b->tcp.flags = flags;
+}
+
+// Writes a TCP payload as MSS sized segments. The template is patched for
+// every segment and copied into the batch, the payload is referenced in place,
+// and the whole batch goes to the file in one gather write. Only the first
+// captured bytes of the payload are in data, the rest are only counted.
+size_t acp_dump_template(acp_sink *fd, acp_template *t, uint8_t *data, int len, int captured, uint32_t *seq1, uint32_t *ack1, uint32_t *seq2, uint32_t *ack2, const std::string *comment) {
+	if (!fd) {
+		return 0;
+	}
 	if (!seq1) {
 		seq1 = &lame_tmp[0];
 	}
@@ -262,6 +541,83 @@ void acp_dump(FILE *fd, int type, int protocol, uint32_t src_ip, uint16_t src_po
 	if (!ack2) {
 		ack2 = &lame_tmp[3];
 	}
+
+	int close_tcp = 0;
+	if (len < 0) {
+		close_tcp = 1;
+		len = 0;
+	}
+	if (!data) {
+		len = 0;
+	}
+	if (captured > len) {
+		captured = len;
+	}
+
+	const size_t frame_size = sizeof(acp_template_block) - ACP_PREFIX_SIZE;
+	size_t segments = len > 0 ? (len + fd->mss - 1) / fd->mss : 1;
+	fd->batch.resize(segments * sizeof(acp_template_block));
+	fd->offsets.resize(segments + 1);
+	fd->spans.resize(segments * 3);
+	fd->trailer.clear();
+
+	size_t written = 0;
+	for (size_t i = 0; i < segments; i++) {
+		int segment = len < fd->mss ? len : fd->mss;
+		uint32_t seq = *seq1;
+		uint32_t ack = *ack1;
+		acp_template_patch(t, segment, seq, ack, acp_tcp_flags(data, segment, close_tcp, seq1, ack1, ack2));
+
+		int segment_captured = captured < segment ? captured : segment;
+		uint32_t caplen = acp_caplen(fd, frame_size, segment_captured);
+		size_t frame_caplen = caplen < frame_size ? caplen : frame_size;
+
+		uint8_t *block = &fd->batch[i * sizeof(acp_template_block)];
+		memcpy(block, &t->block, sizeof(acp_template_block));
+		fd->offsets[i] = fd->trailer.size();
+		size_t header_size = acp_record_header(fd, block + ACP_PREFIX_SIZE, caplen, static_cast<uint32_t>(frame_size + segment), comment, fd->trailer);
+
+		fd->spans[i * 3].Data = block + ACP_PREFIX_SIZE - header_size;
+		fd->spans[i * 3].Size = header_size + frame_caplen;
+		fd->spans[i * 3 + 1].Data = data;
+		fd->spans[i * 3 + 1].Size = caplen - frame_caplen;
+		written += header_size + caplen;
+
+		// Only the captured part of the payload is in data
+		if (data) {
+			data += segment_captured;
+		}
+		captured -= segment_captured;
+		len -= segment;
+	}
+
+	// The trailer may have moved while it grew, so its spans are filled in last
+	fd->offsets[segments] = fd->trailer.size();
+	for (size_t i = 0; i < segments; i++) {
+		fd->spans[i * 3 + 2].Data = fd->trailer.data() + fd->offsets[i];
+		fd->spans[i * 3 + 2].Size = fd->offsets[i + 1] - fd->offsets[i];
+	}
+	written += fd->trailer.size();
+
+	fd->file->Write(fd->spans.data(), fd->spans.size());
+
+	return written;
+}
+
+size_t acp_dump(acp_sink *fd, int type, int protocol, uint32_t src_ip, uint16_t src_port, uint32_t dst_ip, uint16_t dst_port, uint8_t *data, int len, uint32_t *seq1, uint32_t *ack1, uint32_t *seq2, uint32_t *ack2) {
+	char ethdata[14];
+	udph_pseudo udp_ps;
+	uint32_t crc;
+	iph ip;
+	udph udp;
+	icmph icmp;
+	igmph igmp;
+	int size, tpsize;
+	uint8_t *tp;
+
+	if (!fd) {
+		return 0;
+	}
 	if (type < 0) {
 		type = 1;  // WSASocket!
 	}
@@ -288,16 +644,19 @@ void acp_dump(FILE *fd, int type, int protocol, uint32_t src_ip, uint16_t src_po
 		protocol = 255;
 	}
 
+	// TCP is segmented from a template, like the payload of a flow
+	if (type != 3 && protocol == 6) {
+		acp_template t;
+		acp_template_init(&t, src_ip, src_port, dst_ip, dst_port);
+		return acp_dump_template(fd, &t, data, len, len, seq1, ack1, seq2, ack2, NULL);
+	}
+
 	tp = NULL;
 	tpsize = 0;
 
 	if (type == 3) {
 		// SOCK_RAW
 	}
-	else if (protocol == 6) {
-		tp = (uint8_t *)&tcp;
-		tpsize = sizeof(tcph);
-	}
 	else if (protocol == 17) {
 		tp = (uint8_t *)&udp;
 		tpsize = sizeof(udph);
@@ -311,148 +670,111 @@ void acp_dump(FILE *fd, int type, int protocol, uint32_t src_ip, uint16_t src_po
 		tpsize = sizeof(igmph);
 	}
 
-	close_tcp = 0;
-	if (len < 0) {
-		close_tcp = 1;
+	if (len < 0 || !data) {
 		len = 0;
 	}
 
-	if (!data) {
-		len = 0;
-	}
+	memset(ethdata, 0, sizeof(ethdata));
+	ethdata[12] = 8; // Type
 
+	// Payloads too big for one record are split, one slice at a time
+	int max_len;
 	if ((type == 3) && (protocol == 255)) {
-		// SOCK_RAW, IPPROTO_RAW
-		size = len;
+		max_len = 0xFFFF - static_cast<int>(sizeof(acp_record) + sizeof(ethdata));
 	}
 	else {
-		size = sizeof(iph) + tpsize + len;
+		max_len = 0xFFFF - static_cast<int>(sizeof(acp_record) + sizeof(ethdata) + sizeof(iph) + tpsize);
 	}
 
-	memset(ethdata, 0, sizeof(ethdata));
-	ethdata[12] = 8; // Type
-
-	if ((sizeof(acp_pck) + sizeof(ethdata) + size) > 0xFFFF) { // Divides the packet if it's too big
-		size = len; // Use size as new "len" so acp_dump can be called with the same arguments
+	size_t written = 0;
+	do {
+		int segment = len < max_len ? len : max_len;
 		if ((type == 3) && (protocol == 255)) {
-			len = 0xFFFF - (sizeof(acp_pck) + sizeof(ethdata));
+			// SOCK_RAW, IPPROTO_RAW
+			size = segment;
 		}
 		else {
-			len = 0xFFFF - (sizeof(acp_pck) + sizeof(ethdata) + sizeof(iph) + tpsize);
-		}
-		if (len < 0) {
-			len = size;
-		}
-		while (size > 0) {
-			if (size < len) {
-				len = size;
-			}
-			acp_dump(fd, type, protocol, src_ip, src_port, dst_ip, dst_port, data, len, seq1, ack1, seq2, ack2);
-			size -= len;
-			data += len;
+			size = sizeof(iph) + tpsize + segment;
 		}
-		return;
-	}
 
-	// use the following if gettimeofday doesn't exist on Windows
-	acp_pck.ts.tv_sec = time(NULL);
-	acp_pck.ts.tv_usec = GetTickCount();
+		ip.ihl_ver = 0x45;
+		ip.tos = 0;
+		ip.tot_len = net16(size);
+		ip.id = net16(1);
+		ip.frag_off = net16(0);
+		ip.ttl = 128;
+		ip.protocol = protocol;
+		ip.check = net16(0);
+		ip.saddr = src_ip;
+		ip.daddr = dst_ip;
+		ip.check = net16(in_cksum((uint8_t *)&ip, sizeof(iph), NULL));
 
-	acp_pck.caplen = sizeof(ethdata) + size;
-	acp_pck.len = sizeof(ethdata) + size;
+		if (!tp) {
+			// SOCK_RAW
+		}
+		else if (protocol == 17) {
+			udp.source = src_port;
+			udp.dest = dst_port;
+			udp.check = net16(0);
+			udp.len = net16(sizeof(udph) + segment);
 
-	ip.ihl_ver = 0x45;
-	ip.tos = 0;
-	ip.tot_len = net16(size);
-	ip.id = net16(1);
-	ip.frag_off = net16(0);
-	ip.ttl = 128;
-	ip.protocol = protocol;
-	ip.check = net16(0);
-	ip.saddr = src_ip;
-	ip.daddr = dst_ip;
-	ip.check = net16(in_cksum((uint8_t *)&ip, sizeof(iph), NULL));
+			udp_ps.saddr = ip.saddr;
+			udp_ps.daddr = ip.daddr;
+			udp_ps.zero = 0;
+			udp_ps.protocol = 17;
+			udp_ps.length = udp.len;
+			crc = 0;
+			in_cksum(&udp_ps, sizeof(udph_pseudo), &crc);
+			in_cksum(&udp, sizeof(udph), &crc);
+			udp.check = net16(in_cksum(data, segment, &crc));
 
-	if (!tp) {
-		// SOCK_RAW
-	}
-	else if (protocol == 6) {
-		tcp.source = src_port;
-		tcp.dest = dst_port;
-		tcp.seq = net32(*seq1);
-		tcp.ack_seq = net32(*ack1);
-		tcp.doff = sizeof(tcph) << 2;
-		if (close_tcp) {
-			tcp.flags = TH_RST | TH_FIN | TH_ACK;
 		}
-		else if (*seq1 == 1 && *ack1 == 0) {
-			tcp.flags = TH_SYN;
+		else if (protocol == 1) {
+			memset(&icmp, 0, sizeof(icmph));
+			icmp.icmp_type = 8;
+			icmp.icmp_code = 0;
+			crc = 0;
+			in_cksum(&icmp, sizeof(udph_pseudo), &crc);
+			icmp.icmp_cksum = net16(in_cksum(data, segment, &crc));
+
 		}
-		else if (*seq1 == 1 && *ack1 == 2) {
-			tcp.flags = TH_SYN | TH_ACK;
+		else if (protocol == 2) {
+			igmp.igmp_type = 0x11;
+			igmp.igmp_code = 0;
+			igmp.igmp_cksum = net16(0);
+			igmp.igmp_group = net32(0);
+			crc = 0;
+			in_cksum(&igmp, sizeof(udph_pseudo), &crc);
+			igmp.igmp_cksum = net16(in_cksum(data, segment, &crc));
 		}
-		else if (*seq1 == 2 && *ack1 == 2 && !data) {
-			tcp.flags = TH_ACK;
+
+		// Lay out every header in one block so the record goes out in a single gather write
+		uint8_t record[ACP_PREFIX_SIZE + sizeof(ethdata) + sizeof(iph) + sizeof(icmph)];
+		uint8_t *frame = record + ACP_PREFIX_SIZE;
+		size_t frame_size = 0;
+		memcpy(frame + frame_size, ethdata, sizeof(ethdata));
+		frame_size += sizeof(ethdata);
+		if (!(type == 3 && protocol == 255)) {
+			memcpy(frame + frame_size, &ip, sizeof(iph));
+			frame_size += sizeof(iph);
 		}
-		else {
-			tcp.flags = TH_PSH | TH_ACK;
-			*ack2 = *seq1;
-			(*seq1) += len;
+		if (tp) {
+			memcpy(frame + frame_size, tp, tpsize);
+			frame_size += tpsize;
 		}
-		tcp.window = net16(65535);
-		tcp.check = net16(0);
-		tcp.urg_ptr = net16(0);
-
-	}
-	else if (protocol == 17) {
-		udp.source = src_port;
-		udp.dest = dst_port;
-		udp.check = net16(0);
-		udp.len = net16(sizeof(udph) + len);
-
-		udp_ps.saddr = ip.saddr;
-		udp_ps.daddr = ip.daddr;
-		udp_ps.zero = 0;
-		udp_ps.protocol = 17;
-		udp_ps.length = udp.len;
-		crc = 0;
-		in_cksum(&udp_ps, sizeof(udph_pseudo), &crc);
-		in_cksum(&udp, sizeof(udph), &crc);
-		udp.check = net16(in_cksum(data, len, &crc));
 
-	}
-	else if (protocol == 1) {
-		memset(&icmp, 0, sizeof(icmph));
-		icmp.icmp_type = 8;
-		icmp.icmp_code = 0;
-		crc = 0;
-		in_cksum(&icmp, sizeof(udph_pseudo), &crc);
-		icmp.icmp_cksum = net16(in_cksum(data, len, &crc));
+		written += acp_emit(fd, frame, frame_size, data, segment, NULL);
 
-	}
-	else if (protocol == 2) {
-		igmp.igmp_type = 0x11;
-		igmp.igmp_code = 0;
-		igmp.igmp_cksum = net16(0);
-		igmp.igmp_group = net32(0);
-		crc = 0;
-		in_cksum(&igmp, sizeof(udph_pseudo), &crc);
-		igmp.igmp_cksum = net16(in_cksum(data, len, &crc));
-	}
+		if (data) {
+			data += segment;
+		}
+		len -= segment;
+	} while (len > 0);
 
-	fwrite(&acp_pck, sizeof(acp_pck), 1, fd);
-	fwrite(ethdata, sizeof(ethdata), 1, fd);
-	if (!(type == 3 && protocol == 255)) {
-		fwrite(&ip, sizeof(iph), 1, fd);
-	}
-	if (tp) {
-		fwrite(tp, tpsize, 1, fd);
-	}
-	fwrite(data, len, 1, fd);
-	fflush(fd);
+	return written;
 }
 
-void acp_dump_handshake(FILE *fd, int type, int protocol, uint32_t src_ip, uint16_t src_port, uint32_t dst_ip, uint16_t dst_port, uint8_t *data, int len, uint32_t *seq1, uint32_t *ack1, uint32_t *seq2, uint32_t *ack2) {
+void acp_dump_handshake(acp_sink *fd, int type, int protocol, uint32_t src_ip, uint16_t src_port, uint32_t dst_ip, uint16_t dst_port, uint8_t *data, int len, uint32_t *seq1, uint32_t *ack1, uint32_t *seq2, uint32_t *ack2) {
 	if (!fd) {
 		return;
 	}
@@ -483,37 +805,533 @@ void acp_dump_handshake(FILE *fd, int type, int protocol, uint32_t src_ip, uint1
 	(*seq2)++;
 }
 
+// A TCP connection between the client and server of one transfer, with its
+// own sequence numbers so every flow can be reassembled on its own
+struct acp_flow {
+	acp_template client; // Client to server
+	acp_template server; // Server to client
+	bool open; // Handshake written
+	std::string comment; // Attached to every packet in pcapng
+	uint32_t client_seq;
+	uint32_t client_ack;
+	uint32_t server_seq;
+	uint32_t server_ack;
+};
+
+size_t acp_flow_open(acp_sink *fd, acp_flow *flow, uint32_t client_ip, uint16_t client_port, uint32_t server_ip, uint16_t server_port) {
+	acp_template_init(&flow->client, client_ip, client_port, server_ip, server_port);
+	acp_template_init(&flow->server, server_ip, server_port, client_ip, client_port);
+	flow->open = true;
+
+	uint64_t size = fd->file->GetSize();
+	acp_dump_handshake(fd, 1, 6, client_ip, client_port, server_ip, server_port, NULL, 0, 
+		&flow->client_seq, &flow->client_ack, &flow->server_seq, &flow->server_ack);
+
+	return static_cast<size_t>(fd->file->GetSize() - size);
+}
+
+size_t acp_flow_dump(acp_sink *fd, acp_flow *flow, bool from_client, uint8_t *data, int len, int captured) {
+	if (from_client) {
+		return acp_dump_template(fd, &flow->client, data, len, captured, &flow->client_seq, &flow->client_ack, &flow->server_seq, &flow->server_ack, &flow->comment);
+	}
+	return acp_dump_template(fd, &flow->server, data, len, captured, &flow->server_seq, &flow->server_ack, &flow->client_seq, &flow->client_ack, &flow->comment);
+}
+
+// Graceful teardown, FIN from the client, FIN from the server and the final ACK
+size_t acp_flow_close(acp_sink *fd, acp_flow *flow) {
+	size_t frame_size = sizeof(acp_template_block) - ACP_PREFIX_SIZE;
+	size_t written = 0;
+
+	acp_template_patch(&flow->client, 0, flow->client_seq, flow->client_ack, TH_FIN | TH_ACK);
+	written += acp_emit(fd, flow->client.block.ethdata, frame_size, NULL, 0, &flow->comment);
+	flow->client_seq++;
+	flow->server_ack = flow->client_seq;
+
+	acp_template_patch(&flow->server, 0, flow->server_seq, flow->server_ack, TH_FIN | TH_ACK);
+	written += acp_emit(fd, flow->server.block.ethdata, frame_size, NULL, 0, &flow->comment);
+	flow->server_seq++;
+	flow->client_ack = flow->server_seq;
+
+	acp_template_patch(&flow->client, 0, flow->client_seq, flow->client_ack, TH_ACK);
+	written += acp_emit(fd, flow->client.block.ethdata, frame_size, NULL, 0, &flow->comment);
+
+	return written;
+}
+
+// Name of the index-th file of a rotated capture, the index goes before the
+// extensions so curldump.acp.gz becomes curldump_1.acp.gz
+std::string acp_file_name(const std::string &file_name, uint32_t index) {
+	if (index == 0) {
+		return file_name;
+	}
+
+	size_t separator = file_name.find_last_of("/\\");
+	size_t extension = file_name.find('.', separator == std::string::npos ? 0 : separator + 1);
+	if (extension == std::string::npos) {
+		extension = file_name.size();
+	}
+
+	return file_name.substr(0, extension) + "_" + std::to_string(index) + file_name.substr(extension);
+}
+
 // ACPDump.h
-ACPDump::ACPDump() : file_(nullptr), is_open_(false) {
+ACPDump::ACPDump() : is_open_(false), async_(false), format_(kACPFormat_Pcap), start_time_(0), cached_clock_(false), stamp_packets_(true), 
+	write_buffer_size_(4 * 1024 * 1024), compression_(kCaptureCompression_None), compression_level_(0), compression_frame_size_(4 * 1024 * 1024), 
+	mapping_extent_(0), segment_size_(1460), snap_length_(0), flush_policy_(kACPFlushPolicy_Time), flush_interval_(1000), bytes_since_flush_(0), 
+	rotate_size_(0), rotate_interval_(0), rotate_files_(0), file_index_(0), writer_running_(false), writer_idle_(false), producers_(0), 
+	next_file_backoff_(ACP_ROTATE_RETRY_MIN), packets_enqueued_(0), packets_written_(0), packets_dropped_(0), bytes_truncated_(0), 
+	rotations_failed_(0) {
+}
+
+ACPDump::~ACPDump() {
+	Close();
+}
+
+void ACPDump::OnRecordWritten(size_t size) {
+	++packets_written_;
+	bytes_since_flush_ += size;
+
+	switch (flush_policy_) {
+	case kACPFlushPolicy_Packet:
+		Flush();
+		break;
+	case kACPFlushPolicy_Bytes:
+		if (bytes_since_flush_ >= flush_interval_) {
+			Flush();
+		}
+		break;
+	case kACPFlushPolicy_Time:
+		FlushIfDue();
+		break;
+	default:
+		break;
+	}
+
+	RotateIfDue();
+}
+
+void ACPDump::FlushIfDue() {
+	if (flush_policy_ != kACPFlushPolicy_Time || bytes_since_flush_ == 0) {
+		return;
+	}
+
+	if (std::chrono::steady_clock::now() - last_flush_ >= std::chrono::milliseconds(flush_interval_)) {
+		Flush();
+	}
+}
+
+void ACPDump::Flush() {
+	file_->Flush();
+	bytes_since_flush_ = 0;
+	last_flush_ = std::chrono::steady_clock::now();
+}
+
+void ACPDump::PrepareNextFile() {
+	next_file_name_ = acp_file_name(file_name_, file_index_ + 1);
+
+	std::string file_name = next_file_name_;
+	size_t buffer_size = write_buffer_size_;
+	ACPFormat format = format_;
+	CaptureCompression compression = compression_;
+	int compression_level = compression_level_;
+	size_t frame_size = compression_frame_size_;
+	size_t extent = mapping_extent_;
+	uint32_t snaplen = static_cast<uint32_t>(snap_length_);
+	next_file_ = std::async(std::launch::async, [file_name, buffer_size, format, compression, compression_level, frame_size, extent, snaplen]() {
+		std::unique_ptr<CaptureFile> file(new CaptureFile);
+		file->SetCompression(compression, compression_level, frame_size);
+		file->SetMapping(extent);
+		if (!file->Open(file_name, buffer_size)) {
+			return std::unique_ptr<CaptureFile>();
+		}
+
+		acp_sink sink;
+		sink.file = file.get();
+		sink.format = format;
+		sink.clock = nullptr;
+		sink.cached_clock = false;
+		sink.now = 0;
+		sink.counter = 0;
+		sink.mss = 0;
+		sink.snaplen = snaplen;
+		acp_sink_open(&sink);
+		file->Flush();
+
+		return file;
+	});
+}
+
+void ACPDump::RotateIfDue() {
+	if (rotate_size_ == 0 && rotate_interval_ == 0) {
+		return;
+	}
+	if ((rotate_size_ == 0 || file_->GetSize() < rotate_size_) 
+		&& (rotate_interval_ == 0 || std::chrono::steady_clock::now() - file_opened_ < std::chrono::seconds(rotate_interval_))) {
+		return;
+	}
+
+	// The last attempt to open the next file failed, try again once the wait is over
+	if (!next_file_.valid()) {
+		if (std::chrono::steady_clock::now() >= next_file_retry_) {
+			PrepareNextFile();
+		}
+		return;
+	}
+
+	// Never wait for the next file, keep writing to this one until it's ready
+	if (next_file_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+		return;
+	}
+	std::unique_ptr<CaptureFile> file = next_file_.get();
+	if (!file) {
+		// Disk full or no permission, which won't be fixed by the next packet
+		++rotations_failed_;
+		next_file_retry_ = std::chrono::steady_clock::now() + next_file_backoff_;
+		next_file_backoff_ *= 2;
+		if (next_file_backoff_ > std::chrono::seconds(ACP_ROTATE_RETRY_MAX)) {
+			next_file_backoff_ = std::chrono::seconds(ACP_ROTATE_RETRY_MAX);
+		}
+		return;
+	}
+	next_file_backoff_ = std::chrono::seconds(ACP_ROTATE_RETRY_MIN);
+
+	acp_sink_close(sink_.get(), start_time_, packets_written_, packets_dropped_);
+	Flush();
+	file_->Close();
+
+	file_ = std::move(file);
+	sink_->file = file_.get();
+	start_time_ = clock_.Now();
+	file_opened_ = std::chrono::steady_clock::now();
+	file_index_++;
+
+	file_names_.push_back(next_file_name_);
+	while (rotate_files_ > 0 && file_names_.size() > rotate_files_) {
+		remove(file_names_.front().c_str());
+		file_names_.pop_front();
+	}
+
+	PrepareNextFile();
+}
+
+size_t ACPDump::WritePacket(const PacketHeader &header, uint8_t *data, size_t captured_length) {
+	sink_->counter = header.Counter;
+
+	if (header.Kind == kRecordKind_Packet) {
+		return acp_dump(sink_.get(), header.Type, header.Protocol, header.SourceAddress, header.SourcePort, header.DestinationAddress, 
+			header.DestinationPort, data, static_cast<int>(captured_length), nullptr, nullptr, nullptr, nullptr);
+	}
+
+	size_t written = 0;
+	auto it = flows_.find(header.FlowId);
+	if (header.Kind == kRecordKind_FlowClose) {
+		if (it != flows_.end()) {
+			if (it->second->open) {
+				written = acp_flow_close(sink_.get(), it->second.get());
+			}
+			flows_.erase(it);
+		}
+		return written;
+	}
+
+	if (it == flows_.end()) {
+		std::unique_ptr<acp_flow> flow(new acp_flow);
+		flow->open = false;
+		it = flows_.emplace(header.FlowId, std::move(flow)).first;
+	}
+
+	if (header.Kind == kRecordKind_FlowComment) {
+		it->second->comment.assign(reinterpret_cast<char *>(data), captured_length);
+		return 0;
+	}
+
+	// First packet of the flow, start it with a handshake
+	if (!it->second->open) {
+		written += acp_flow_open(sink_.get(), it->second.get(), header.SourceAddress, header.SourcePort, header.DestinationAddress, header.DestinationPort);
+	}
+
+	return written + acp_flow_dump(sink_.get(), it->second.get(), header.Direction == kACPDirection_ClientToServer, data, 
+		static_cast<int>(header.Length), static_cast<int>(captured_length));
+}
+
+void ACPDump::CloseFlows() {
+	for (auto &flow : flows_) {
+		if (flow.second->open) {
+			acp_flow_close(sink_.get(), flow.second.get());
+		}
+	}
+	flows_.clear();
+}
+
+bool ACPDump::Enqueue(const PacketHeader &header, const void *buffer, size_t captured_length) {
+	// Announce the producer before looking at is_open_, so Close either sees
+	// it in producers_ or this sees the dump closed
+	++producers_;
+	if (!is_open_) {
+		--producers_;
+		return false;
+	}
+
+	if (!async_) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		++packets_enqueued_;
+		OnRecordWritten(WritePacket(header, static_cast<uint8_t *>(const_cast<void *>(buffer)), captured_length));
+		--producers_;
+		return true;
+	}
+
+	if (!queue_->Write(&header, sizeof(PacketHeader), buffer, captured_length)) {
+		// Never block the transfer thread on the writer, drop the packet instead
+		++packets_dropped_;
+		--producers_;
+		return false;
+	}
+	++packets_enqueued_;
+
+	if (writer_idle_) {
+		queue_condition_.notify_one();
+	}
+
+	--producers_;
+	return true;
 }
 
-bool ACPDump::Open(std::string file_name) {
+void ACPDump::WriterThread() {
+	auto write_record = [this](const uint8_t *record, size_t size) {
+		PacketHeader header;
+		memcpy(&header, record, sizeof(PacketHeader));
+
+		OnRecordWritten(WritePacket(header, const_cast<uint8_t *>(record) + sizeof(PacketHeader), size - sizeof(PacketHeader)));
+	};
+
+	while (writer_running_) {
+		// One clock read for the whole batch
+		if (sink_->cached_clock) {
+			sink_->now = clock_.Now();
+		}
+		if (queue_->Read(write_record) > 0) {
+			continue;
+		}
+
+		// Idle, so a time based flush or rotation doesn't have to wait for the next packet
+		FlushIfDue();
+		RotateIfDue();
+
+		// Nothing to do, sleep until a producer wakes us up. Producers notify
+		// without the lock, so a missed wake up only costs the timeout.
+		std::unique_lock<std::mutex> lock(mutex_);
+		writer_idle_ = true;
+		if (queue_->IsEmpty() && writer_running_) {
+			queue_condition_.wait_for(lock, std::chrono::milliseconds(1));
+		}
+		writer_idle_ = false;
+	}
+
+	// Drain whatever was queued before Close
+	while (!queue_->IsEmpty()) {
+		if (sink_->cached_clock) {
+			sink_->now = clock_.Now();
+		}
+		if (queue_->Read(write_record) == 0) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool ACPDump::Open(std::string file_name, bool async, size_t queue_size) {
 	if (is_open_) {
 		return false;
 	}
 
-	if (fopen_s(&file_, file_name.c_str(), "wb") != 0 || file_ == nullptr) {
+	file_.reset(new CaptureFile);
+	file_->SetCompression(compression_, compression_level_, compression_frame_size_);
+	file_->SetMapping(mapping_extent_);
+	if (!file_->Open(file_name, write_buffer_size_)) {
+		file_.reset();
 		return false;
 	}
 
-	create_acp(file_);
+	// Timestamps come from the monotonic counter, pinned to wall time once here
+	clock_.Calibrate();
+	start_time_ = clock_.Now();
+
+	sink_.reset(new acp_sink);
+	sink_->file = file_.get();
+	sink_->format = format_;
+	sink_->clock = &clock_;
+	sink_->cached_clock = async && cached_clock_;
+	sink_->now = start_time_;
+	sink_->counter = 0;
+	sink_->mss = static_cast<int>(segment_size_);
+	sink_->snaplen = static_cast<uint32_t>(snap_length_);
+	acp_sink_open(sink_.get());
+
+	bytes_since_flush_ = 0;
+	last_flush_ = std::chrono::steady_clock::now();
+
+	file_name_ = file_name;
+	file_index_ = 0;
+	file_names_.clear();
+	file_names_.push_back(file_name);
+	file_opened_ = std::chrono::steady_clock::now();
+	next_file_backoff_ = std::chrono::seconds(ACP_ROTATE_RETRY_MIN);
+	if (rotate_size_ > 0 || rotate_interval_ > 0) {
+		PrepareNextFile();
+	}
+
+	async_ = async;
+	stamp_packets_ = !sink_->cached_clock;
+	packets_enqueued_ = 0;
+	packets_written_ = 0;
+	packets_dropped_ = 0;
+	bytes_truncated_ = 0;
+	rotations_failed_ = 0;
+
+	if (async_) {
+		queue_.reset(new RingBuffer(queue_size));
+		writer_running_ = true;
+		writer_thread_ = std::thread(&ACPDump::WriterThread, this);
+	}
+
 	is_open_ = true;
 
 	return true;
 }
 
 void ACPDump::Close() {
-	fclose(file_);
-	is_open_ = false;
+	if (!is_open_.exchange(false)) {
+		return;
+	}
+
+	// New producers see the dump closed, wait out the ones already past the check
+	while (producers_ > 0) {
+		std::this_thread::yield();
+	}
+
+	if (async_) {
+		writer_running_ = false;
+		queue_condition_.notify_one();
+		writer_thread_.join();
+		queue_.reset();
+	}
+
+	mutex_.lock();
+	CloseFlows();
+	acp_sink_close(sink_.get(), start_time_, packets_written_, packets_dropped_);
+	Flush();
+	file_->Close();
+	file_.reset();
+	sink_.reset();
+	mutex_.unlock();
+
+	// The next file was never used
+	if (next_file_.valid()) {
+		std::unique_ptr<CaptureFile> file = next_file_.get();
+		if (file) {
+			file->Close();
+			remove(next_file_name_.c_str());
+		}
+	}
 }
 
-bool ACPDump::Write(int32_t type, int32_t protocol, uint32_t source_address, uint16_t source_port, uint32_t destination_address, uint16_t destination_port, char *buffer, size_t length) const {
-	if (!is_open_) {
+void ACPDump::SetFlushPolicy(ACPFlushPolicy policy, uint64_t interval) {
+	flush_policy_ = policy;
+	flush_interval_ = interval;
+}
+
+void ACPDump::SetWriteBufferSize(size_t size) {
+	write_buffer_size_ = size;
+}
+
+void ACPDump::SetFormat(ACPFormat format) {
+	format_ = format;
+}
+
+void ACPDump::SetSegmentSize(size_t size) {
+	const size_t max_size = 0xFFFF - sizeof(iph) - sizeof(tcph);
+	segment_size_ = size == 0 ? 1 : (size > max_size ? max_size : size);
+}
+
+void ACPDump::SetSnapLength(size_t length) {
+	snap_length_ = length;
+}
+
+void ACPDump::SetCachedClock(bool cached) {
+	cached_clock_ = cached;
+}
+
+bool ACPDump::SetCompression(CaptureCompression compression, int level, size_t frame_size) {
+	if (!CaptureFile::IsCompressionSupported(compression) || frame_size == 0) {
 		return false;
 	}
 
-	acp_dump(file_, type, protocol, source_address, source_port, destination_address, destination_port, reinterpret_cast<uint8_t *>(buffer), length, nullptr, nullptr, nullptr, nullptr);
+	compression_ = compression;
+	compression_level_ = level;
+	compression_frame_size_ = frame_size;
+
+	return true;
+}
+
+bool ACPDump::SetMapping(size_t extent) {
+	if (extent > 0 && !CaptureFile::IsMappingSupported()) {
+		return false;
+	}
+	mapping_extent_ = extent;
 
 	return true;
 }
+
+void ACPDump::SetRotation(uint64_t size, uint64_t interval, size_t files) {
+	rotate_size_ = size;
+	rotate_interval_ = interval;
+	rotate_files_ = files;
+}
+
+bool ACPDump::Write(int32_t type, int32_t protocol, uint32_t source_address, uint16_t source_port, uint32_t destination_address, uint16_t destination_port, char *buffer, size_t length) {
+	PacketHeader header = { 0, GetPacketCounter(), type, protocol, source_address, destination_address, static_cast<uint32_t>(length), source_port, destination_port, 
+		kRecordKind_Packet, 0 };
+	return Enqueue(header, buffer, length);
+}
+
+bool ACPDump::WriteFlow(uint64_t flow_id, ACPDirection direction, uint32_t client_address, uint16_t client_port, uint32_t server_address, 
+	uint16_t server_port, char *buffer, size_t length, size_t captured_length) {
+	if (captured_length > length) {
+		captured_length = length;
+	}
+	bytes_truncated_ += length - captured_length;
+
+	PacketHeader header = { flow_id, GetPacketCounter(), 6, 6, client_address, server_address, static_cast<uint32_t>(length), client_port, server_port, 
+		kRecordKind_FlowData, static_cast<uint8_t>(direction) };
+	return Enqueue(header, buffer, captured_length);
+}
+
+bool ACPDump::SetFlowComment(uint64_t flow_id, std::string comment) {
+	PacketHeader header = { flow_id, 0, 6, 6, 0, 0, static_cast<uint32_t>(comment.size()), 0, 0, kRecordKind_FlowComment, 0 };
+	return Enqueue(header, comment.data(), comment.size());
+}
+
+bool ACPDump::CloseFlow(uint64_t flow_id) {
+	PacketHeader header = { flow_id, GetPacketCounter(), 6, 6, 0, 0, 0, 0, 0, kRecordKind_FlowClose, 0 };
+	return Enqueue(header, nullptr, 0);
+}
+
+uint64_t ACPDump::GetPacketsEnqueued() const {
+	return packets_enqueued_;
+}
+
+uint64_t ACPDump::GetPacketsWritten() const {
+	return packets_written_;
+}
+
+uint64_t ACPDump::GetPacketsDropped() const {
+	return packets_dropped_;
+}
+
+uint64_t ACPDump::GetBytesTruncated() const {
+	return bytes_truncated_;
+}
+
+uint64_t ACPDump::GetRotationsFailed() const {
+	return rotations_failed_;
+}
 }
\ No newline at end of file
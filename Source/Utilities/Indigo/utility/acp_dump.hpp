@@ -9,23 +9,218 @@
 #ifndef INDIGO_UTILITY_ACP_DUMP_H_
 #define INDIGO_UTILITY_ACP_DUMP_H_
 
+#include "../core/ring_buffer.hpp"
+#include "../core/clock.hpp"
+#include "capture_file.hpp"
 #include <stdint.h>
+#include <string>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <deque>
+#include <unordered_map>
 
 namespace indigo {
+struct acp_flow;
+struct acp_sink;
+
+enum ACPFormat {
+	kACPFormat_Pcap, // Classic libpcap
+	kACPFormat_PcapNG // pcapng with per-flow comments and capture statistics
+};
+
+enum ACPDirection {
+	kACPDirection_ClientToServer,
+	kACPDirection_ServerToClient
+};
+
+enum ACPFlushPolicy {
+	kACPFlushPolicy_Packet, // Flush after every packet, for debugging
+	kACPFlushPolicy_Bytes, // Flush once the interval in bytes has been written
+	kACPFlushPolicy_Time, // Flush once the interval in milliseconds has passed
+	kACPFlushPolicy_Close // Only flush when the write buffer fills up or on close
+};
+
 class ACPDump {
-	FILE *file_;
-	bool is_open_;
+	enum RecordKind : uint8_t {
+		kRecordKind_Packet, // Standalone packet, see Write
+		kRecordKind_FlowData, // Payload of a tracked flow, see WriteFlow
+		kRecordKind_FlowComment, // Description of a tracked flow, see SetFlowComment
+		kRecordKind_FlowClose // End of a tracked flow, see CloseFlow
+	};
+
+	// Precedes the payload of every record in the ring. For flow records the
+	// source is the client and the destination the server. Length is the size
+	// of the payload on the wire, only the captured part of it follows.
+	// Counter is the Clock::GetCounter reading from when the record was handed
+	// over, so the packet's timestamp doesn't depend on when the writer gets
+	// to it. It is zero when the writer stamps whole batches, see SetCachedClock.
+	struct PacketHeader {
+		uint64_t FlowId;
+		uint64_t Counter;
+		int32_t Type;
+		int32_t Protocol;
+		uint32_t SourceAddress;
+		uint32_t DestinationAddress;
+		uint32_t Length;
+		uint16_t SourcePort;
+		uint16_t DestinationPort;
+		uint8_t Kind;
+		uint8_t Direction;
+	};
+
+	std::unique_ptr<CaptureFile> file_;
+	std::atomic<bool> is_open_;
+	bool async_;
+	ACPFormat format_;
+	std::unique_ptr<acp_sink> sink_;
+	uint64_t start_time_;
+	Clock clock_;
+	bool cached_clock_;
+	bool stamp_packets_; // Producers read the clock, false when the writer stamps batches
+
+	// Records are collected in this many bytes before they reach the disk
+	size_t write_buffer_size_;
+
+	CaptureCompression compression_;
+	int compression_level_;
+	size_t compression_frame_size_;
+	size_t mapping_extent_;
+	size_t segment_size_;
+	size_t snap_length_;
+
+	ACPFlushPolicy flush_policy_;
+	uint64_t flush_interval_;
+	uint64_t bytes_since_flush_;
+	std::chrono::steady_clock::time_point last_flush_;
+
+	// Rotation, a limit of zero disables it. The next file is opened and its
+	// header written in the background so a rollover is only a pointer swap.
+	uint64_t rotate_size_;
+	uint64_t rotate_interval_;
+	size_t rotate_files_;
+	std::string file_name_;
+	uint32_t file_index_;
+	std::deque<std::string> file_names_;
+	std::chrono::steady_clock::time_point file_opened_;
+	std::future<std::unique_ptr<CaptureFile>> next_file_;
+	std::string next_file_name_;
+
+	// After the next file fails to open it is tried again no sooner than this,
+	// waiting twice as long after every failure in a row
+	std::chrono::steady_clock::time_point next_file_retry_;
+	std::chrono::seconds next_file_backoff_;
+
+	// Guards the file in synchronous mode and lets the writer sleep in asynchronous mode
 	std::mutex mutex_;
+	std::condition_variable queue_condition_;
+	std::unique_ptr<RingBuffer> queue_;
+	std::thread writer_thread_;
+	std::atomic<bool> writer_running_;
+	std::atomic<bool> writer_idle_;
+
+	// Producers inside Enqueue, Close waits for them before it tears down the
+	// ring and the sink
+	std::atomic<uint32_t> producers_;
+
+	// Only touched by whoever owns the file, see OnRecordWritten
+	std::unordered_map<uint64_t, std::unique_ptr<acp_flow>> flows_;
+
+	std::atomic<uint64_t> packets_enqueued_;
+	std::atomic<uint64_t> packets_written_;
+	std::atomic<uint64_t> packets_dropped_;
+	std::atomic<uint64_t> bytes_truncated_;
+	std::atomic<uint64_t> rotations_failed_;
+
+	uint64_t GetPacketCounter() const {
+		return stamp_packets_ ? Clock::GetCounter() : 0;
+	}
+
+	void WriterThread();
+	bool Enqueue(const PacketHeader &header, const void *buffer, size_t captured_length);
+	size_t WritePacket(const PacketHeader &header, uint8_t *data, size_t captured_length);
+	void CloseFlows();
+
+	// Must be called by whoever currently owns the file, the writer thread in
+	// asynchronous mode or the holder of mutex_ in synchronous mode
+	void OnRecordWritten(size_t size);
+	void FlushIfDue();
+	void Flush();
+	void PrepareNextFile();
+	void RotateIfDue();
 
 public:
 	ACPDump();
+	~ACPDump();
 
-	bool Open(std::string file_name);
+	// When async is set, Write only copies the payload into a lock-free ring of
+	// queue_size bytes and a dedicated thread writes it to the file
+	bool Open(std::string file_name, bool async = false, size_t queue_size = 16 * 1024 * 1024);
 	void Close();
 
+	// All take effect on the next Open
+	void SetFlushPolicy(ACPFlushPolicy policy, uint64_t interval = 0);
+	void SetWriteBufferSize(size_t size);
+	void SetFormat(ACPFormat format);
+
+	// Rolls over to a new file once the current one holds size bytes or is
+	// interval seconds old, keeping at most files of them (like tcpdump -C, -G
+	// and -W). Further files are named after the one given to Open with an
+	// index appended, for example curldump_1.acp, curldump_1_1.acp and so on.
+	void SetRotation(uint64_t size, uint64_t interval, size_t files);
+
+	// Compresses the capture on the writing side, ending a frame every
+	// frame_size bytes and whenever a file is closed or rotated. Fails when
+	// the codec wasn't compiled in, see CaptureCompression.
+	bool SetCompression(CaptureCompression compression, int level, size_t frame_size);
+
+	// Writes through a memory-mapped view instead of buffered writes, growing
+	// the file extent bytes at a time. Zero disables it, see CaptureFile.
+	bool SetMapping(size_t extent);
+
+	// Largest TCP payload per packet, 1460 for Ethernet, 9000 for jumbo frames,
+	// up to 65495 for what fits in one IP packet. Longer payloads are split.
+	void SetSegmentSize(size_t size);
+
+	// Keeps at most this many bytes of every packet, headers included, and
+	// records the rest only in its length. Zero keeps whole packets.
+	void SetSnapLength(size_t length);
+
+	// Packets are normally stamped when they are written. In asynchronous mode
+	// this instead reads the clock once per batch the writer takes off the
+	// ring, which saves a clock read per packet but stamps every packet of a
+	// batch with the time it was dequeued.
+	void SetCachedClock(bool cached);
+
 	bool Write(int32_t type, int32_t protocol, uint32_t source_address, uint16_t source_port, 
-		uint32_t destination_address, uint16_t destination_port, char *buffer, size_t length) const;
+		uint32_t destination_address, uint16_t destination_port, char *buffer, size_t length);
+
+	// Writes the payload as part of a TCP flow with its own sequence numbers.
+	// The first write of a flow id emits the handshake, CloseFlow emits the
+	// teardown and lets the id be reused. Flows still open on Close are closed.
+	// Only the first captured_length bytes of the buffer are copied, the rest
+	// still advances the sequence numbers but is left out of the capture.
+	bool WriteFlow(uint64_t flow_id, ACPDirection direction, uint32_t client_address, uint16_t client_port, 
+		uint32_t server_address, uint16_t server_port, char *buffer, size_t length, size_t captured_length = SIZE_MAX);
+	bool CloseFlow(uint64_t flow_id);
+
+	// Attached to every packet of the flow in pcapng, ignored for pcap
+	bool SetFlowComment(uint64_t flow_id, std::string comment);
+
+	uint64_t GetPacketsEnqueued() const;
+	uint64_t GetPacketsWritten() const;
+	uint64_t GetPacketsDropped() const;
+
+	// Payload bytes that were counted but not copied, see WriteFlow
+	uint64_t GetBytesTruncated() const;
+
+	// Times the next file couldn't be opened, the capture stays in the current
+	// file meanwhile
+	uint64_t GetRotationsFailed() const;
 };
 }
 
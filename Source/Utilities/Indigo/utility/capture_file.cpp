@@ -0,0 +1,597 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "capture_file.hpp"
+#include "../platform.h"
+#include <string.h>
+#if defined(OS_LINUX)
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#elif defined(OS_WIN)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#include <io.h>
+#endif
+#if defined(INDIGO_CAPTURE_ZLIB)
+#include <zlib.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "zlib.lib")
+#endif
+#endif
+#if defined(INDIGO_CAPTURE_ZSTD)
+#include <zstd.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "zstd.lib")
+#endif
+#endif
+
+namespace indigo {
+CaptureFile::CaptureFile() : file_(nullptr), buffer_used_(0), size_(0), compression_(kCaptureCompression_None), compression_level_(0), 
+	frame_size_(4 * 1024 * 1024), frame_used_(0), stream_(nullptr), extent_size_(0), mapped_(false), view_(nullptr), view_offset_(0), 
+	view_used_(0) {
+}
+
+CaptureFile::~CaptureFile() {
+	Close();
+}
+
+bool CaptureFile::IsCompressionSupported(CaptureCompression compression) {
+	switch (compression) {
+	case kCaptureCompression_None:
+		return true;
+#if defined(INDIGO_CAPTURE_ZLIB)
+	case kCaptureCompression_Gzip:
+		return true;
+#endif
+#if defined(INDIGO_CAPTURE_ZSTD)
+	case kCaptureCompression_Zstd:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+bool CaptureFile::SetCompression(CaptureCompression compression, int level, size_t frame_size) {
+	if (!IsCompressionSupported(compression) || frame_size == 0) {
+		return false;
+	}
+
+	compression_ = compression;
+	compression_level_ = level;
+	frame_size_ = frame_size;
+
+	return true;
+}
+
+bool CaptureFile::IsMappingSupported() {
+#if defined(OS_LINUX) || defined(OS_WIN)
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool CaptureFile::SetMapping(size_t extent_size) {
+	if (extent_size > 0 && !IsMappingSupported()) {
+		return false;
+	}
+
+	// Whole megabytes keep every view aligned to the page size and the allocation granularity
+	const size_t megabyte = 1024 * 1024;
+	extent_size_ = (extent_size + megabyte - 1) / megabyte * megabyte;
+
+	return true;
+}
+
+// Grows the file to cover the extent at offset and maps a view of it
+bool CaptureFile::MapExtent(uint64_t offset) {
+	uint64_t end = offset + extent_size_;
+#if defined(OS_LINUX)
+	int descriptor = fileno(file_);
+
+	// Allocate the blocks up front, or at least extend the file where the file system can't
+	if (posix_fallocate(descriptor, static_cast<off_t>(offset), static_cast<off_t>(extent_size_)) != 0 
+		&& ftruncate(descriptor, static_cast<off_t>(end)) != 0) {
+		return false;
+	}
+
+	void *view = mmap(nullptr, extent_size_, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, static_cast<off_t>(offset));
+	if (view == MAP_FAILED) {
+		return false;
+	}
+#elif defined(OS_WIN)
+	HANDLE file = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file_)));
+
+	// A mapping larger than the file grows the file to match
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(end >> 32), static_cast<DWORD>(end), nullptr);
+	if (mapping == nullptr) {
+		return false;
+	}
+
+	// The view keeps the mapping alive
+	void *view = MapViewOfFile(mapping, FILE_MAP_WRITE, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), extent_size_);
+	CloseHandle(mapping);
+	if (view == nullptr) {
+		return false;
+	}
+#else
+	void *view = nullptr;
+	(void)end;
+	return false;
+#endif
+
+	view_ = static_cast<uint8_t *>(view);
+	view_offset_ = offset;
+	view_used_ = 0;
+
+	return true;
+}
+
+void CaptureFile::UnmapExtent() {
+	if (view_ == nullptr) {
+		return;
+	}
+
+#if defined(OS_LINUX)
+	munmap(view_, extent_size_);
+#elif defined(OS_WIN)
+	UnmapViewOfFile(view_);
+#endif
+	view_ = nullptr;
+}
+
+bool CaptureFile::WriteMapped(const void *data, size_t size) {
+	const uint8_t *input = static_cast<const uint8_t *>(data);
+	while (size > 0) {
+		// Slide the view over to the next extent
+		if (view_ == nullptr || view_used_ == extent_size_) {
+			uint64_t offset = view_offset_ + extent_size_;
+			UnmapExtent();
+			if (!MapExtent(offset)) {
+				return false;
+			}
+		}
+
+		size_t chunk = extent_size_ - view_used_;
+		if (chunk > size) {
+			chunk = size;
+		}
+		memcpy(view_ + view_used_, input, chunk);
+		view_used_ += chunk;
+
+		input += chunk;
+		size -= chunk;
+	}
+
+	return true;
+}
+
+bool CaptureFile::OpenStream() {
+	frame_used_ = 0;
+
+	switch (compression_) {
+#if defined(INDIGO_CAPTURE_ZLIB)
+	case kCaptureCompression_Gzip: {
+		z_stream *stream = new z_stream;
+		memset(stream, 0, sizeof(z_stream));
+		// 16 added to the window bits asks for a gzip header instead of a zlib one
+		if (deflateInit2(stream, compression_level_ == 0 ? Z_DEFAULT_COMPRESSION : compression_level_, Z_DEFLATED, 15 + 16, 8, 
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+			delete stream;
+			return false;
+		}
+		stream_ = stream;
+		output_.resize(64 * 1024);
+		return true;
+	}
+#endif
+#if defined(INDIGO_CAPTURE_ZSTD)
+	case kCaptureCompression_Zstd: {
+		ZSTD_CCtx *stream = ZSTD_createCCtx();
+		if (stream == nullptr) {
+			return false;
+		}
+		ZSTD_CCtx_setParameter(stream, ZSTD_c_compressionLevel, compression_level_ == 0 ? ZSTD_CLEVEL_DEFAULT : compression_level_);
+		ZSTD_CCtx_setParameter(stream, ZSTD_c_checksumFlag, 1);
+		stream_ = stream;
+		output_.resize(ZSTD_CStreamOutSize());
+		return true;
+	}
+#endif
+	default:
+		return true;
+	}
+}
+
+void CaptureFile::CloseStream() {
+	if (stream_ == nullptr) {
+		return;
+	}
+
+	switch (compression_) {
+#if defined(INDIGO_CAPTURE_ZLIB)
+	case kCaptureCompression_Gzip:
+		deflateEnd(static_cast<z_stream *>(stream_));
+		delete static_cast<z_stream *>(stream_);
+		break;
+#endif
+#if defined(INDIGO_CAPTURE_ZSTD)
+	case kCaptureCompression_Zstd:
+		ZSTD_freeCCtx(static_cast<ZSTD_CCtx *>(stream_));
+		break;
+#endif
+	default:
+		break;
+	}
+	stream_ = nullptr;
+
+	output_.clear();
+	output_.shrink_to_fit();
+}
+
+// Runs one piece of input through the codec and writes whatever comes out
+bool CaptureFile::CompressChunk(const uint8_t *data, size_t size, FlushMode mode) {
+	switch (compression_) {
+#if defined(INDIGO_CAPTURE_ZLIB)
+	case kCaptureCompression_Gzip: {
+		z_stream *stream = static_cast<z_stream *>(stream_);
+		int flush = mode == kFlushMode_Frame ? Z_FINISH : (mode == kFlushMode_Sync ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+		stream->next_in = const_cast<Bytef *>(data);
+		stream->avail_in = static_cast<uInt>(size);
+
+		int result;
+		do {
+			stream->next_out = output_.data();
+			stream->avail_out = static_cast<uInt>(output_.size());
+			result = deflate(stream, flush);
+			if (result == Z_STREAM_ERROR) {
+				return false;
+			}
+
+			size_t produced = output_.size() - stream->avail_out;
+			if (produced > 0 && fwrite(output_.data(), produced, 1, file_) != 1) {
+				return false;
+			}
+		} while (flush == Z_FINISH ? result != Z_STREAM_END : stream->avail_out == 0);
+
+		// The next frame starts a new gzip member
+		return flush != Z_FINISH || deflateReset(stream) == Z_OK;
+	}
+#endif
+#if defined(INDIGO_CAPTURE_ZSTD)
+	case kCaptureCompression_Zstd: {
+		ZSTD_CCtx *stream = static_cast<ZSTD_CCtx *>(stream_);
+		ZSTD_EndDirective directive = mode == kFlushMode_Frame ? ZSTD_e_end : (mode == kFlushMode_Sync ? ZSTD_e_flush : ZSTD_e_continue);
+		ZSTD_inBuffer input = { data, size, 0 };
+
+		size_t remaining;
+		do {
+			ZSTD_outBuffer output = { output_.data(), output_.size(), 0 };
+			remaining = ZSTD_compressStream2(stream, &output, &input, directive);
+			if (ZSTD_isError(remaining)) {
+				return false;
+			}
+
+			if (output.pos > 0 && fwrite(output_.data(), output.pos, 1, file_) != 1) {
+				return false;
+			}
+		} while (directive == ZSTD_e_continue ? input.pos < input.size : remaining != 0);
+
+		return true;
+	}
+#endif
+	default:
+		(void)data;
+		(void)size;
+		(void)mode;
+		return false;
+	}
+}
+
+// Splits the input at frame boundaries, so every frame holds frame_size_ bytes
+bool CaptureFile::Compress(const void *data, size_t size, FlushMode mode) {
+	const uint8_t *input = static_cast<const uint8_t *>(data);
+	while (size > 0) {
+		size_t chunk = frame_size_ - frame_used_;
+		if (chunk > size) {
+			chunk = size;
+		}
+
+		frame_used_ += chunk;
+		bool frame_full = frame_used_ == frame_size_;
+		if (!CompressChunk(input, chunk, frame_full ? kFlushMode_Frame : kFlushMode_None)) {
+			return false;
+		}
+		if (frame_full) {
+			frame_used_ = 0;
+		}
+
+		input += chunk;
+		size -= chunk;
+	}
+
+	// Nothing pending when the last frame just ended
+	if (mode == kFlushMode_None || frame_used_ == 0) {
+		return true;
+	}
+	if (mode == kFlushMode_Frame) {
+		frame_used_ = 0;
+	}
+
+	return CompressChunk(nullptr, 0, mode);
+}
+
+bool CaptureFile::WriteBuffer(FlushMode mode) {
+	if (stream_ != nullptr) {
+		bool result = Compress(buffer_.data(), buffer_used_, mode);
+		buffer_used_ = 0;
+		return result;
+	}
+
+	if (buffer_used_ > 0) {
+		if (fwrite(buffer_.data(), buffer_used_, 1, file_) != 1) {
+			return false;
+		}
+		buffer_used_ = 0;
+	}
+
+	return true;
+}
+
+bool CaptureFile::Open(std::string file_name, size_t buffer_size) {
+	if (file_ != nullptr) {
+		return false;
+	}
+
+	// Mapping a view for writing needs read access as well
+	mapped_ = extent_size_ > 0 && compression_ == kCaptureCompression_None;
+	const char *mode = mapped_ ? "w+b" : "wb";
+
+#if defined(OS_WIN)
+	if (fopen_s(&file_, file_name.c_str(), mode) != 0 || file_ == nullptr) {
+		file_ = nullptr;
+		return false;
+	}
+#else
+	file_ = fopen(file_name.c_str(), mode);
+	if (file_ == nullptr) {
+		return false;
+	}
+#endif
+
+	// We do our own buffering, the CRT's would only add another copy
+	setvbuf(file_, nullptr, _IONBF, 0);
+
+	if (!OpenStream()) {
+		fclose(file_);
+		file_ = nullptr;
+		return false;
+	}
+
+	if (mapped_) {
+		if (!MapExtent(0)) {
+			fclose(file_);
+			file_ = nullptr;
+			return false;
+		}
+		buffer_size = 0;
+	}
+
+	buffer_.resize(buffer_size);
+	buffer_used_ = 0;
+	size_ = 0;
+
+	return true;
+}
+
+void CaptureFile::Close() {
+	if (file_ == nullptr) {
+		return;
+	}
+
+	if (mapped_) {
+		// Drop the preallocated space past what was written
+		UnmapExtent();
+#if defined(OS_LINUX)
+		if (ftruncate(fileno(file_), static_cast<off_t>(size_)) != 0) {
+			// Not fatal, the file just keeps its zero padding
+		}
+#elif defined(OS_WIN)
+		_chsize_s(_fileno(file_), static_cast<__int64>(size_));
+#endif
+		mapped_ = false;
+	}
+
+	// Ends the last frame, so the file is complete
+	WriteBuffer(kFlushMode_Frame);
+	fflush(file_);
+	fclose(file_);
+	file_ = nullptr;
+	CloseStream();
+
+	buffer_.clear();
+	buffer_.shrink_to_fit();
+	buffer_used_ = 0;
+}
+
+bool CaptureFile::IsOpen() const {
+	return file_ != nullptr;
+}
+
+#if defined(OS_LINUX)
+// Writes all vectors, writev may stop short
+static bool write_vectors(int descriptor, struct iovec *vector, int count) {
+	while (count > 0) {
+		ssize_t written = writev(descriptor, vector, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		// Skip what was written
+		size_t remaining = static_cast<size_t>(written);
+		while (count > 0 && remaining >= vector->iov_len) {
+			remaining -= vector->iov_len;
+			++vector;
+			--count;
+		}
+		if (count > 0) {
+			vector->iov_base = static_cast<uint8_t *>(vector->iov_base) + remaining;
+			vector->iov_len -= remaining;
+		}
+	}
+
+	return true;
+}
+#endif
+
+bool CaptureFile::WriteDirect(const CaptureSpan *spans, size_t count, size_t size) {
+	if (stream_ != nullptr) {
+		if (!WriteBuffer(kFlushMode_None)) {
+			return false;
+		}
+		for (size_t i = 0; i < count; i++) {
+			if (!Compress(spans[i].Data, spans[i].Size, kFlushMode_None)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+#if defined(OS_LINUX)
+	(void)size;
+
+	// Pending buffer and the spans in as few system calls as possible
+	const int max_vectors = 64;
+	struct iovec vectors[max_vectors];
+	int vector_count = 0;
+	if (buffer_used_ > 0) {
+		vectors[vector_count++] = { buffer_.data(), buffer_used_ };
+	}
+
+	size_t next = 0;
+	do {
+		for (; next < count && vector_count < max_vectors; next++) {
+			if (spans[next].Size > 0) {
+				vectors[vector_count++] = { const_cast<void *>(spans[next].Data), spans[next].Size };
+			}
+		}
+		if (!write_vectors(fileno(file_), vectors, vector_count)) {
+			return false;
+		}
+		vector_count = 0;
+	} while (next < count);
+	buffer_used_ = 0;
+
+	return true;
+#else
+	if (!Flush()) {
+		return false;
+	}
+	if (size <= buffer_.size()) {
+		for (size_t i = 0; i < count; i++) {
+			if (spans[i].Size > 0) {
+				memcpy(buffer_.data() + buffer_used_, spans[i].Data, spans[i].Size);
+				buffer_used_ += spans[i].Size;
+			}
+		}
+		return true;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (spans[i].Size > 0 && fwrite(spans[i].Data, spans[i].Size, 1, file_) != 1) {
+			return false;
+		}
+	}
+	return true;
+#endif
+}
+
+bool CaptureFile::Write(const void *data, size_t size) {
+	return Write(data, size, nullptr, 0);
+}
+
+bool CaptureFile::Write(const void *header, size_t header_size, const void *data, size_t data_size, const void *trailer, size_t trailer_size) {
+	CaptureSpan spans[3] = {
+		{ header, header_size },
+		{ data, data_size },
+		{ trailer, trailer_size }
+	};
+
+	return Write(spans, 3);
+}
+
+bool CaptureFile::Write(const CaptureSpan *spans, size_t count) {
+	if (file_ == nullptr) {
+		return false;
+	}
+
+	size_t size = 0;
+	for (size_t i = 0; i < count; i++) {
+		size += spans[i].Size;
+	}
+
+	if (mapped_) {
+		for (size_t i = 0; i < count; i++) {
+			if (!WriteMapped(spans[i].Data, spans[i].Size)) {
+				return false;
+			}
+		}
+		size_ += size;
+		return true;
+	}
+
+	// Common case, one copy into the buffer and no system call
+	if (buffer_used_ + size <= buffer_.size()) {
+		for (size_t i = 0; i < count; i++) {
+			if (spans[i].Size > 0) {
+				memcpy(buffer_.data() + buffer_used_, spans[i].Data, spans[i].Size);
+				buffer_used_ += spans[i].Size;
+			}
+		}
+		size_ += size;
+		return true;
+	}
+
+	// Doesn't fit, write the buffer out together with the spans
+	if (!WriteDirect(spans, count, size)) {
+		return false;
+	}
+	size_ += size;
+
+	return true;
+}
+
+bool CaptureFile::Flush() {
+	if (file_ == nullptr) {
+		return false;
+	}
+
+	// The view is the page cache, the data is already visible to the operating system
+	if (mapped_) {
+		return true;
+	}
+
+	if (!WriteBuffer(kFlushMode_Sync)) {
+		return false;
+	}
+
+	return fflush(file_) == 0;
+}
+
+uint64_t CaptureFile::GetSize() const {
+	return size_;
+}
+}
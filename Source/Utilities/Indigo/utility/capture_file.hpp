@@ -0,0 +1,115 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef INDIGO_UTILITY_CAPTURE_FILE_H_
+#define INDIGO_UTILITY_CAPTURE_FILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace indigo {
+// Compression needs the library's headers in Dependencies\Includes and its
+// library in Dependencies\Libraries, so each codec is only compiled in when
+// INDIGO_CAPTURE_ZLIB or INDIGO_CAPTURE_ZSTD is defined
+enum CaptureCompression {
+	kCaptureCompression_None,
+	kCaptureCompression_Gzip, // .gz, one gzip member per frame
+	kCaptureCompression_Zstd // .zst, one zstd frame per frame
+};
+
+// One piece of a record, see CaptureFile::Write
+struct CaptureSpan {
+	const void *Data;
+	size_t Size;
+};
+
+// Output file for capture records. Records are handed over as a header block,
+// a payload and an optional trailer and reach the file in a single gather
+// write: on Linux they go out with one writev, elsewhere they are copied once
+// into a user-space buffer that is written out when it fills up.
+//
+// A compressed file passes the buffer through the compressor instead. Frames
+// end every frame size bytes of input and on Close, a Flush in between only
+// makes what was written so far decodable without ending the frame.
+//
+// A mapped file skips both: the file is grown an extent at a time and records
+// are copied straight into a view of the current extent, so writing costs no
+// system call until the extent is full. Close truncates the file to the bytes
+// actually written. Mapping isn't used for compressed files.
+class CaptureFile {
+	enum FlushMode {
+		kFlushMode_None,
+		kFlushMode_Sync,
+		kFlushMode_Frame
+	};
+
+	FILE *file_;
+	std::vector<uint8_t> buffer_;
+	size_t buffer_used_;
+	uint64_t size_;
+
+	CaptureCompression compression_;
+	int compression_level_;
+	size_t frame_size_;
+	size_t frame_used_;
+	void *stream_;
+	std::vector<uint8_t> output_;
+
+	size_t extent_size_;
+	bool mapped_;
+	uint8_t *view_;
+	uint64_t view_offset_;
+	size_t view_used_;
+
+	bool MapExtent(uint64_t offset);
+	void UnmapExtent();
+	bool WriteMapped(const void *data, size_t size);
+
+	bool OpenStream();
+	void CloseStream();
+	bool CompressChunk(const uint8_t *data, size_t size, FlushMode mode);
+	bool Compress(const void *data, size_t size, FlushMode mode);
+	bool WriteBuffer(FlushMode mode);
+	bool WriteDirect(const CaptureSpan *spans, size_t count, size_t size);
+
+public:
+	CaptureFile();
+	~CaptureFile();
+
+	static bool IsCompressionSupported(CaptureCompression compression);
+	static bool IsMappingSupported();
+
+	// Takes effect on the next Open, a level of zero picks the codec's default
+	bool SetCompression(CaptureCompression compression, int level, size_t frame_size);
+
+	// Takes effect on the next Open, zero goes back to buffered writes. The
+	// extent is rounded up to a whole megabyte. Fails where mapping isn't supported.
+	bool SetMapping(size_t extent_size);
+
+	bool Open(std::string file_name, size_t buffer_size);
+	void Close();
+	bool IsOpen() const;
+
+	bool Write(const void *data, size_t size);
+	bool Write(const void *header, size_t header_size, const void *data, size_t data_size, 
+		const void *trailer = nullptr, size_t trailer_size = 0);
+
+	// Writes the spans back to back in one gather write, for a batch of records
+	bool Write(const CaptureSpan *spans, size_t count);
+
+	// Hands everything buffered so far to the operating system
+	bool Flush();
+
+	// Number of bytes written before compression, including those still buffered
+	uint64_t GetSize() const;
+};
+}
+
+#endif // INDIGO_UTILITY_CAPTURE_FILE_H_
@@ -0,0 +1,278 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_capture_filter_hpp_
+#define indigo_capture_filter_hpp_
+
+#include <stdint.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_set>
+
+namespace indigo {
+// Prefix set over bytes, a string matches when one of the prefixes starts it
+class PrefixTrie {
+	struct Node {
+		std::vector<std::pair<char, uint32_t>> Children;
+		bool Terminal;
+	};
+
+	std::vector<Node> nodes_;
+
+	int32_t FindChild(uint32_t node, char character) const {
+		for (auto &child : nodes_[node].Children) {
+			if (child.first == character) {
+				return static_cast<int32_t>(child.second);
+			}
+		}
+		return -1;
+	}
+
+public:
+	PrefixTrie() : nodes_(1, Node{ {}, false }) {
+	}
+
+	void Insert(const std::string &prefix) {
+		uint32_t node = 0;
+		for (char character : prefix) {
+			int32_t child = FindChild(node, character);
+			if (child < 0) {
+				child = static_cast<int32_t>(nodes_.size());
+				nodes_.push_back(Node{ {}, false });
+				nodes_[node].Children.push_back(std::make_pair(character, static_cast<uint32_t>(child)));
+			}
+			node = static_cast<uint32_t>(child);
+		}
+		nodes_[node].Terminal = true;
+	}
+
+	bool IsEmpty() const {
+		return nodes_.size() == 1 && !nodes_[0].Terminal;
+	}
+
+	bool MatchesPrefix(const char *string, size_t length) const {
+		uint32_t node = 0;
+		for (size_t i = 0; ; i++) {
+			if (nodes_[node].Terminal) {
+				return true;
+			}
+			if (i == length) {
+				return false;
+			}
+			int32_t child = FindChild(node, string[i]);
+			if (child < 0) {
+				return false;
+			}
+			node = static_cast<uint32_t>(child);
+		}
+	}
+};
+
+// Decides which transfers are captured from include and exclude rules on the
+// URL host, the URL path, the request method and the request content type.
+// Hosts are exact names or *.domain wildcards kept in a hash set, paths and
+// content types are prefixes kept in a trie, methods are exact. A transfer
+// is captured when every kind of rule with includes has a matching include
+// and no exclude matches. Content type rules only apply to requests that set
+// a Content-Type header.
+class CaptureFilter {
+	struct RuleSet {
+		std::unordered_set<std::string> Hosts;
+		std::unordered_set<std::string> Domains; // From *.domain, stored as .domain
+		PrefixTrie Paths;
+		std::unordered_set<std::string> Methods;
+		PrefixTrie ContentTypes;
+
+		bool HasHosts() const {
+			return !Hosts.empty() || !Domains.empty();
+		}
+
+		bool MatchesHost(const std::string &host) const {
+			if (Hosts.find(host) != Hosts.end()) {
+				return true;
+			}
+			if (Domains.empty()) {
+				return false;
+			}
+			for (size_t dot = host.find('.'); dot != std::string::npos; dot = host.find('.', dot + 1)) {
+				if (Domains.find(host.substr(dot)) != Domains.end()) {
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	RuleSet include_;
+	RuleSet exclude_;
+	bool empty_;
+
+	static std::string ToLower(std::string string) {
+		for (auto &character : string) {
+			character = static_cast<char>(tolower(static_cast<unsigned char>(character)));
+		}
+		return string;
+	}
+
+	static std::string ToUpper(std::string string) {
+		for (auto &character : string) {
+			character = static_cast<char>(toupper(static_cast<unsigned char>(character)));
+		}
+		return string;
+	}
+
+	static std::string Trim(const std::string &string) {
+		size_t begin = string.find_first_not_of(" \t");
+		if (begin == std::string::npos) {
+			return std::string();
+		}
+		return string.substr(begin, string.find_last_not_of(" \t") - begin + 1);
+	}
+
+	// Calls the callback for every non-empty item of a comma separated list
+	template<typename _TCallback>
+	static void ForEachItem(const std::string &list, _TCallback callback) {
+		size_t begin = 0;
+		while (begin <= list.size()) {
+			size_t end = list.find(',', begin);
+			if (end == std::string::npos) {
+				end = list.size();
+			}
+			std::string item = Trim(list.substr(begin, end - begin));
+			if (!item.empty()) {
+				callback(item);
+			}
+			begin = end + 1;
+		}
+	}
+
+	void AddHosts(RuleSet &rules, const std::string &list) {
+		ForEachItem(list, [&](const std::string &item) {
+			std::string host = ToLower(item);
+			if (host.compare(0, 2, "*.") == 0) {
+				rules.Domains.insert(host.substr(1));
+			} else {
+				rules.Hosts.insert(host);
+			}
+			empty_ = false;
+		});
+	}
+
+	void AddPaths(RuleSet &rules, const std::string &list) {
+		ForEachItem(list, [&](const std::string &item) {
+			rules.Paths.Insert(item);
+			empty_ = false;
+		});
+	}
+
+	void AddMethods(RuleSet &rules, const std::string &list) {
+		ForEachItem(list, [&](const std::string &item) {
+			rules.Methods.insert(ToUpper(item));
+			empty_ = false;
+		});
+	}
+
+	void AddContentTypes(RuleSet &rules, const std::string &list) {
+		ForEachItem(list, [&](const std::string &item) {
+			rules.ContentTypes.Insert(ToLower(item));
+			empty_ = false;
+		});
+	}
+
+public:
+	CaptureFilter() : empty_(true) {
+	}
+
+	// Each list is comma separated, empty lists add no rules
+	void Compile(const std::string &include_hosts, const std::string &exclude_hosts, const std::string &include_paths,
+		const std::string &exclude_paths, const std::string &include_methods, const std::string &exclude_methods,
+		const std::string &include_content_types, const std::string &exclude_content_types) {
+		AddHosts(include_, include_hosts);
+		AddHosts(exclude_, exclude_hosts);
+		AddPaths(include_, include_paths);
+		AddPaths(exclude_, exclude_paths);
+		AddMethods(include_, include_methods);
+		AddMethods(exclude_, exclude_methods);
+		AddContentTypes(include_, include_content_types);
+		AddContentTypes(exclude_, exclude_content_types);
+	}
+
+	// Without rules everything is captured
+	bool IsEmpty() const {
+		return empty_;
+	}
+
+	// Splits scheme://user@host:port/path?query into the lower case host and the path
+	static void ParseUrl(const std::string &url, std::string &host, std::string &path) {
+		size_t begin = url.find("://");
+		begin = begin == std::string::npos ? 0 : begin + 3;
+		size_t end = url.find_first_of("/?#", begin);
+		if (end == std::string::npos) {
+			end = url.size();
+		}
+
+		std::string authority = url.substr(begin, end - begin);
+		size_t at = authority.rfind('@');
+		if (at != std::string::npos) {
+			authority = authority.substr(at + 1);
+		}
+		size_t port = authority[0] == '[' ? authority.find("]:") : authority.rfind(':');
+		if (port != std::string::npos) {
+			authority = authority.substr(0, authority[0] == '[' ? port + 1 : port);
+		}
+		host = ToLower(authority);
+
+		size_t path_end = url.find_first_of("?#", end);
+		path = end < url.size() && url[end] == '/' ? url.substr(end, path_end == std::string::npos ? std::string::npos : path_end - end) : "/";
+	}
+
+	// method is upper case, content_type is empty when the request doesn't set one
+	bool Matches(const std::string &url, const std::string &method, const std::string &content_type) const {
+		if (empty_) {
+			return true;
+		}
+
+		std::string host, path;
+		ParseUrl(url, host, path);
+
+		if (include_.HasHosts() && !include_.MatchesHost(host)) {
+			return false;
+		}
+		if (exclude_.HasHosts() && exclude_.MatchesHost(host)) {
+			return false;
+		}
+		if (!include_.Paths.IsEmpty() && !include_.Paths.MatchesPrefix(path.data(), path.size())) {
+			return false;
+		}
+		if (!exclude_.Paths.IsEmpty() && exclude_.Paths.MatchesPrefix(path.data(), path.size())) {
+			return false;
+		}
+		if (!include_.Methods.empty() && include_.Methods.find(method) == include_.Methods.end()) {
+			return false;
+		}
+		if (exclude_.Methods.find(method) != exclude_.Methods.end()) {
+			return false;
+		}
+		if (!content_type.empty()) {
+			std::string type = ToLower(content_type);
+			if (!include_.ContentTypes.IsEmpty() && !include_.ContentTypes.MatchesPrefix(type.data(), type.size())) {
+				return false;
+			}
+			if (!exclude_.ContentTypes.IsEmpty() && exclude_.ContentTypes.MatchesPrefix(type.data(), type.size())) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+}
+
+#endif // indigo_capture_filter_hpp_
@@ -0,0 +1,149 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_capture_sampler_hpp_
+#define indigo_capture_sampler_hpp_
+
+#include "hash.hpp"
+#include "../core/clock.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <algorithm>
+
+namespace indigo {
+// Decides which transfers are captured when not all of them can be. Three
+// limits, each off when 0:
+// - 1 in N transfers, picked by a hash of the owner and URL so the choice is
+//   deterministic for a given transfer
+// - a token bucket of captured bytes per second, transfers are only admitted
+//   while it has tokens and payload past it is left out of the capture
+// - a maximum number of flows captured at the same time
+// Admit and Take are lock-free so they can be called from transfer threads.
+class CaptureSampler {
+	uint32_t rate_;
+	uint64_t byte_rate_;
+	int64_t byte_burst_;
+	size_t max_flows_;
+
+	uint64_t frequency_;
+	std::atomic<int64_t> tokens_;
+	std::atomic<uint64_t> last_refill_;
+	std::atomic<size_t> flows_;
+	std::atomic<uint64_t> transfers_skipped_;
+
+	// Adds the tokens earned since the last refill, capped at the burst
+	void Refill() {
+		uint64_t now = Clock::GetCounter();
+		uint64_t last = last_refill_.load(std::memory_order_relaxed);
+		if (now <= last) {
+			return;
+		}
+		int64_t earned = static_cast<int64_t>(static_cast<double>(now - last) * byte_rate_ / frequency_);
+		if (earned <= 0) {
+			return;
+		}
+
+		// Only one thread gets to add the tokens for a period
+		if (!last_refill_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+			return;
+		}
+
+		int64_t current = tokens_.load(std::memory_order_relaxed);
+		while (!tokens_.compare_exchange_weak(current, (std::min)(current + earned, byte_burst_), std::memory_order_relaxed)) {
+		}
+	}
+
+public:
+	CaptureSampler() : rate_(0), byte_rate_(0), byte_burst_(0), max_flows_(0), frequency_(Clock::GetFrequency()), tokens_(0),
+		last_refill_(Clock::GetCounter()), flows_(0), transfers_skipped_(0) {
+	}
+
+	// Capture 1 in rate transfers
+	void SetRate(uint32_t rate) {
+		rate_ = rate;
+	}
+
+	// Capture at most byte_rate bytes per second on average and byte_burst
+	// bytes at once, the burst defaults to one second worth of bytes
+	void SetByteRate(uint64_t byte_rate, uint64_t byte_burst = 0) {
+		byte_rate_ = byte_rate;
+		byte_burst_ = static_cast<int64_t>(byte_burst != 0 ? byte_burst : byte_rate);
+		tokens_ = byte_burst_;
+		last_refill_ = Clock::GetCounter();
+	}
+
+	void SetMaxFlows(size_t max_flows) {
+		max_flows_ = max_flows;
+	}
+
+	// Whether a transfer is captured. An admitted transfer holds a flow slot
+	// until Leave is called for it.
+	bool Admit(const void *owner, const std::string &url) {
+		if (rate_ > 1) {
+			uint64_t hash = Hash::FNV1A_64(reinterpret_cast<uint8_t *>(const_cast<void **>(&owner)), sizeof(owner));
+			hash = Hash::FNV1A_64(reinterpret_cast<uint8_t *>(const_cast<char *>(url.data())), url.size(), Hash::FNV1A_Prime64, hash);
+			if (hash % rate_ != 0) {
+				++transfers_skipped_;
+				return false;
+			}
+		}
+
+		if (byte_rate_ != 0) {
+			Refill();
+			if (tokens_.load(std::memory_order_relaxed) <= 0) {
+				++transfers_skipped_;
+				return false;
+			}
+		}
+
+		if (max_flows_ != 0) {
+			size_t flows = flows_.load(std::memory_order_relaxed);
+			do {
+				if (flows >= max_flows_) {
+					++transfers_skipped_;
+					return false;
+				}
+			} while (!flows_.compare_exchange_weak(flows, flows + 1, std::memory_order_relaxed));
+		}
+
+		return true;
+	}
+
+	// Gives an admitted transfer's flow slot back
+	void Leave() {
+		if (max_flows_ != 0) {
+			--flows_;
+		}
+	}
+
+	// Takes up to bytes tokens, returns how many of the bytes may be captured
+	size_t Take(size_t bytes) {
+		if (byte_rate_ == 0 || bytes == 0) {
+			return bytes;
+		}
+
+		Refill();
+
+		int64_t available = tokens_.load(std::memory_order_relaxed);
+		while (available > 0) {
+			int64_t granted = (std::min)(available, static_cast<int64_t>(bytes));
+			if (tokens_.compare_exchange_weak(available, available - granted, std::memory_order_relaxed)) {
+				return static_cast<size_t>(granted);
+			}
+		}
+
+		return 0;
+	}
+
+	uint64_t GetTransfersSkipped() const {
+		return transfers_skipped_;
+	}
+};
+}
+
+#endif // indigo_capture_sampler_hpp_
@@ -0,0 +1,135 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_flow_allocator_hpp_
+#define indigo_flow_allocator_hpp_
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+namespace indigo {
+// Endpoints of a captured flow, addresses and ports in network byte order
+struct CaptureFlow {
+	uint64_t Id;
+	uint32_t ClientAddress;
+	uint16_t ClientPort;
+	uint32_t ServerAddress;
+	uint16_t ServerPort;
+};
+
+// Hands out a unique client endpoint and flow id for every owner (for example
+// a curl easy handle). Each owner gets a slot, and the slot decides the client
+// address and port, 10.0.0.1:49152 onwards, so no two live flows collide.
+// Released slots are reused oldest first so a tuple isn't reused right after
+// its flow ended. The server end is always 127.0.0.1:80.
+class FlowAllocator {
+	static const uint32_t kPortsPerAddress = 16384;
+	static const uint16_t kFirstPort = 49152;
+	static const uint32_t kFirstAddress = 0x0A000001; // 10.0.0.1
+	static const uint32_t kServerAddress = 0x7F000001; // 127.0.0.1
+	static const uint16_t kServerPort = 80;
+
+	struct Slot {
+		CaptureFlow Flow;
+		size_t Index;
+	};
+
+	std::mutex mutex_;
+	std::unordered_map<void *, Slot> owners_;
+	std::deque<size_t> free_slots_;
+	size_t slot_count_;
+	uint64_t next_id_;
+
+	static uint32_t ToNetwork32(uint32_t value) {
+		uint8_t bytes[4] = { static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16),
+			static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) };
+		uint32_t result;
+		memcpy(&result, bytes, sizeof(result));
+		return result;
+	}
+
+	static uint16_t ToNetwork16(uint16_t value) {
+		uint8_t bytes[2] = { static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) };
+		uint16_t result;
+		memcpy(&result, bytes, sizeof(result));
+		return result;
+	}
+
+public:
+	FlowAllocator() : slot_count_(0), next_id_(1) {
+	}
+
+	// Returns the owner's flow, allocating one if it doesn't have one yet
+	CaptureFlow Acquire(void *owner) {
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto it = owners_.find(owner);
+		if (it != owners_.end()) {
+			return it->second.Flow;
+		}
+
+		size_t index;
+		if (!free_slots_.empty()) {
+			index = free_slots_.front();
+			free_slots_.pop_front();
+		} else {
+			index = slot_count_++;
+		}
+
+		Slot slot;
+		slot.Index = index;
+		slot.Flow.Id = next_id_++;
+		slot.Flow.ClientAddress = ToNetwork32(kFirstAddress + static_cast<uint32_t>(index / kPortsPerAddress));
+		slot.Flow.ClientPort = ToNetwork16(static_cast<uint16_t>(kFirstPort + index % kPortsPerAddress));
+		slot.Flow.ServerAddress = ToNetwork32(kServerAddress);
+		slot.Flow.ServerPort = ToNetwork16(kServerPort);
+		owners_.emplace(owner, slot);
+
+		return slot.Flow;
+	}
+
+	bool Find(void *owner, CaptureFlow *flow) {
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto it = owners_.find(owner);
+		if (it == owners_.end()) {
+			return false;
+		}
+		*flow = it->second.Flow;
+
+		return true;
+	}
+
+	// Gives the owner's tuple back, the next Acquire for it starts a new flow
+	bool Release(void *owner) {
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto it = owners_.find(owner);
+		if (it == owners_.end()) {
+			return false;
+		}
+		free_slots_.push_back(it->second.Index);
+		owners_.erase(it);
+
+		return true;
+	}
+
+	void Clear() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		owners_.clear();
+		free_slots_.clear();
+		slot_count_ = 0;
+	}
+};
+}
+
+#endif // indigo_flow_allocator_hpp_
@@ -9,10 +9,19 @@
 #ifndef indigo_logger_hpp_
 #define indigo_logger_hpp_
 
+#include "trace.hpp"
+#include "../core/clock.hpp"
+#include "../core/ring_buffer.hpp"
 #include <ostream>
 #include <iomanip>
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <mutex>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <utility>
 #include <stdarg.h>
 
 namespace indigo {
@@ -23,14 +32,176 @@ enum LogType {
 	kLogType_Trace
 };
 
+// Writes log messages to any number of streams. Write formats with printf
+// and writes on the calling thread. In deferred mode WriteDeferred only
+// records the format's address and the raw arguments into a lock-free ring of
+// the calling thread, a background thread does the formatting, timestamping
+// and writing.
+// Example:
+//    Logger logger(kLogType_Info);
+//    logger.AddStream(std::cout);
+//    logger.SetDeferred(true);
+//    logger.WriteDeferred(kLogType_Info, "Hook", "Installed %d hooks", count);
 class Logger {
+	static const uint32_t kDeferredInterval = 10; // Milliseconds between drains
+
+	struct DeferredRecord {
+		uint64_t Counter; // Clock::GetCounter when written
+		const char *ClassName;
+		const char *Format;
+		uint32_t Type;
+	};
+
+	struct DeferredRing {
+		RingBuffer Ring;
+		std::atomic<uint64_t> Dropped;
+
+		DeferredRing(size_t size) : Ring(size), Dropped(0) {
+		}
+	};
+
 	LogType level_;
 	std::vector<std::ostream *> streams_;
 	std::mutex streams_mutex_;
 
+	// Deferred mode
+	uint64_t id_;
+	std::atomic<bool> deferred_;
+	size_t ring_size_;
+	std::vector<std::shared_ptr<DeferredRing>> rings_;
+	std::mutex rings_mutex_;
+	std::condition_variable rings_condition_;
+	std::thread writer_;
+	bool writer_running_;
+	Clock clock_;
+
+	static uint64_t NextId() {
+		static std::atomic<uint64_t> id(0);
+		return ++id;
+	}
+
+	static const char *GetTypeString(LogType type) {
+		switch (type) {
+		case indigo::kLogType_Error:
+			return "ERROR";
+		case indigo::kLogType_Warning:
+			return "WARNING";
+		case indigo::kLogType_Trace:
+			return "TRACE";
+		case kLogType_Info: 
+			return "INFO";
+		default:
+			return "UNKN";
+		}
+	}
+
+	void WriteMessage(LogType type, const char *class_name, const char *message, time_t current_time) {
+		tm local_time;
+		localtime_s(&local_time, &current_time);
+
+		streams_mutex_.lock();
+		for (auto &stream : streams_) {
+			*stream << "[" << std::setw(2) << std::setfill('0') << local_time.tm_hour
+				<< ":" << std::setw(2) << std::setfill('0') << local_time.tm_min
+				<< ":" << std::setw(2) << std::setfill('0') << local_time.tm_sec
+				<< "][" << GetTypeString(type) << ":" << class_name 
+				<< "]: " << message << std::endl;
+		}
+		streams_mutex_.unlock();
+	}
+
+	// The calling thread's ring for this logger, created on first use. Rings
+	// are found by logger id so a new logger at the same address never picks
+	// up a dead one's ring.
+	DeferredRing &GetRing() {
+		thread_local std::vector<std::pair<uint64_t, std::shared_ptr<DeferredRing>>> rings;
+		for (auto &ring : rings) {
+			if (ring.first == id_) {
+				return *ring.second;
+			}
+		}
+
+		// Forget the rings of loggers that are gone, only this thread holds them
+		rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::pair<uint64_t, std::shared_ptr<DeferredRing>> &ring) {
+			return ring.second.use_count() == 1;
+		}), rings.end());
+
+		auto ring = std::make_shared<DeferredRing>(ring_size_);
+		{
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			rings_.push_back(ring);
+		}
+		rings.emplace_back(id_, ring);
+		return *ring;
+	}
+
+	// Formats and writes every deferred record, oldest first
+	void Drain() {
+		std::vector<std::shared_ptr<DeferredRing>> rings;
+		{
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+
+			// Forget rings of threads that exited once they are empty
+			rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<DeferredRing> &ring) {
+				return ring.use_count() == 1 && ring->Ring.IsEmpty();
+			}), rings_.end());
+			rings = rings_;
+		}
+
+		struct Message {
+			uint64_t Counter;
+			LogType Type;
+			const char *ClassName;
+			std::string Text;
+		};
+
+		std::vector<Message> messages;
+		uint64_t dropped = 0;
+		for (auto &ring : rings) {
+			ring->Ring.Read([&](const uint8_t *data, size_t size) {
+				DeferredRecord record;
+				memcpy(&record, data, sizeof(DeferredRecord));
+				messages.push_back(Message{ record.Counter, static_cast<LogType>(record.Type), record.ClassName, 
+					TraceArguments::Format(record.Format, data + sizeof(DeferredRecord), size - sizeof(DeferredRecord)) });
+			});
+			dropped += ring->Dropped.exchange(0, std::memory_order_relaxed);
+		}
+
+		// Each ring is in order already, a stable sort interleaves the threads
+		std::stable_sort(messages.begin(), messages.end(), [](const Message &left, const Message &right) {
+			return left.Counter < right.Counter;
+		});
+
+		for (auto &message : messages) {
+			WriteMessage(message.Type, message.ClassName, message.Text.c_str(), static_cast<time_t>(clock_.ToTime(message.Counter) / 1000000000ULL));
+		}
+		if (dropped > 0) {
+			std::string text = std::to_string(dropped) + " deferred messages dropped";
+			WriteMessage(kLogType_Warning, "Logger", text.c_str(), time(nullptr));
+		}
+	}
+
+	void WriterThread() {
+		std::unique_lock<std::mutex> lock(rings_mutex_);
+		while (writer_running_) {
+			rings_condition_.wait_for(lock, std::chrono::milliseconds(kDeferredInterval));
+
+			lock.unlock();
+			Drain();
+			lock.lock();
+		}
+	}
+
 public:
-	Logger() : level_(kLogType_Error) {}
-	Logger(LogType level) : level_(level) {}
+	Logger() : level_(kLogType_Error), id_(NextId()), deferred_(false), ring_size_(0), writer_running_(false) {}
+	Logger(LogType level) : level_(level), id_(NextId()), deferred_(false), ring_size_(0), writer_running_(false) {}
+
+	Logger(const Logger &) = delete;
+	Logger &operator=(const Logger &) = delete;
+
+	~Logger() {
+		SetDeferred(false);
+	}
 
 	void AddStream(std::ostream &stream) {
 		streams_mutex_.lock();
@@ -71,6 +242,63 @@ public:
 		level_ = level;
 	}
 
+	// Turns deferred mode on or off. ring_size is the ring each writing thread
+	// gets, messages that don't fit are dropped and counted. Turning it off
+	// writes out what is pending.
+	void SetDeferred(bool deferred, size_t ring_size = 256 * 1024) {
+		if (deferred) {
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			if (writer_running_) {
+				return;
+			}
+			ring_size_ = ring_size;
+			clock_.Calibrate();
+			writer_running_ = true;
+			writer_ = std::thread(&Logger::WriterThread, this);
+			deferred_ = true;
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			if (!writer_running_) {
+				return;
+			}
+			deferred_ = false;
+			writer_running_ = false;
+		}
+
+		rings_condition_.notify_one();
+		writer_.join();
+		Drain();
+	}
+
+	bool IsDeferred() const {
+		return deferred_.load(std::memory_order_relaxed);
+	}
+
+	// For literal class names and formats, the pointers are kept until the
+	// message is written. Strings passed as arguments are copied. Deferred when
+	// deferred mode is on, written right away otherwise. Formats like Trace,
+	// without length modifiers or * widths, see TraceArguments.
+	template<typename... _TArgs>
+	void WriteDeferred(LogType type, const char *class_name, const char *format, const _TArgs &... args) {
+		TraceArguments arguments;
+		arguments.Add(args...);
+
+		if (!deferred_.load(std::memory_order_relaxed)) {
+			std::string message = TraceArguments::Format(format, arguments.GetData(), arguments.GetSize());
+			WriteMessage(type, class_name, message.c_str(), time(nullptr));
+			return;
+		}
+
+		DeferredRing &ring = GetRing();
+		DeferredRecord record = { Clock::GetCounter(), class_name, format, static_cast<uint32_t>(type) };
+		if (!ring.Ring.Write(&record, sizeof(DeferredRecord), arguments.GetData(), arguments.GetSize())) {
+			ring.Dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
 	void Write(LogType type, std::string class_name, std::string format, ...) {
 		va_list arguments;
 		va_start(arguments, format);
@@ -85,38 +313,7 @@ public:
 
 		va_end(arguments);
 
-		const char *type_string = "";
-		switch (type) {
-		case indigo::kLogType_Error:
-			type_string = "ERROR";
-			break;
-		case indigo::kLogType_Warning:
-			type_string = "WARNING";
-			break;
-		case indigo::kLogType_Trace:
-			type_string = "TRACE";
-			break;
-		case kLogType_Info: 
-			type_string = "INFO";
-			break;
-		default:
-			type_string = "UNKN";
-		}
-
-		time_t current_time;
-		time(&current_time);
-		tm local_time;
-		localtime_s(&local_time, &current_time);
-
-		streams_mutex_.lock();
-		for (auto &stream : streams_) {
-			*stream << "[" << std::setw(2) << std::setfill('0') << local_time.tm_hour
-				<< ":" << std::setw(2) << std::setfill('0') << local_time.tm_min
-				<< ":" << std::setw(2) << std::setfill('0') << local_time.tm_sec
-				<< "][" << type_string << ":" << class_name.c_str() 
-				<< "]: " << message.data() << std::endl;
-		}
-		streams_mutex_.unlock();
+		WriteMessage(type, class_name.c_str(), message.data(), time(nullptr));
 	}
 };
 }
@@ -15,6 +15,10 @@
 #endif
 
 #include "../core/string.hpp"
+#include "multi_scanner.hpp"
+#include "pattern_scanner.hpp"
+#include "pe_image.hpp"
+#include "signature.hpp"
 #include <vector>
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -72,6 +76,13 @@ public:
 	}
 };
 
+struct MemorySection {
+	std::string Name;
+	void *Start;
+	size_t Size;
+	bool Executable;
+};
+
 class Memory {
 public:
 	template<typename _TRVA>
@@ -111,69 +122,81 @@ public:
 		return reinterpret_cast<void *>(reinterpret_cast<char *>(address) + GetNTHeader(address)->OptionalHeader.AddressOfEntryPoint);
 	}
 
-	static void *Find(void *start_address, size_t search_length, const char *pattern, const char *mask) {
-		size_t mask_length = strlen(mask);
-
-		for (size_t i = 0; i < search_length - mask_length; ++i) {
-			size_t found_bytes = 0;
-
-			for (size_t j = 0; j < mask_length; ++j) {
-				char byte_read = *reinterpret_cast<char *>(static_cast<char *>(start_address) + i + j);
+	// Sections of a loaded image, as they are laid out in memory
+	static std::vector<MemorySection> GetSections(void *address = GetProcessBaseAddress()) {
+		std::vector<MemorySection> sections;
+		PEImage image(address, GetProcessImageSize(address), kPEImageLayout_Loaded);
+		for (const PESection &image_section : image.GetSections()) {
+			MemorySection section;
+			section.Name = image_section.Name;
+			section.Start = static_cast<char *>(address) + image_section.VirtualAddress;
+			section.Size = image_section.VirtualSize != 0 ? image_section.VirtualSize : image_section.RawSize;
+			section.Executable = image_section.IsExecutable();
+			sections.push_back(section);
+		}
+		return sections;
+	}
 
-				if (byte_read != pattern[j] && mask[j] != '?') {
-					break;
-				}
+	// Where code can be, the executable sections or the code range from the
+	// optional header if there are none
+	static std::vector<ScanRange> GetCodeRanges(void *address = GetProcessBaseAddress()) {
+		std::vector<ScanRange> ranges = PEImage(address, GetProcessImageSize(address), kPEImageLayout_Loaded).GetCodeRanges();
+		if (ranges.empty()) {
+			ranges.push_back(ScanRange{ static_cast<const uint8_t *>(GetProcessTextSectionStart(address)), GetProcessTextSectionSize(address) });
+		}
+		return ranges;
+	}
 
-				++found_bytes;
+	static void *Find(void *start_address, size_t search_length, const char *pattern, const char *mask) {
+		PatternScanner scanner(reinterpret_cast<const uint8_t *>(pattern), mask);
+		return const_cast<uint8_t *>(scanner.Find(static_cast<const uint8_t *>(start_address), search_length));
+	}
 
-				if (found_bytes == mask_length) {
-					return static_cast<char *>(start_address) + i;
-				}
-			}
+	static MemoryPointerList Find(void *start_address, size_t search_length, const Signature &signature) {
+		std::vector<MemoryPointer> pointers;
+		for (const uint8_t *match : signature.FindAll(static_cast<const uint8_t *>(start_address), search_length)) {
+			pointers.push_back(const_cast<uint8_t *>(match));
 		}
-
-		return nullptr;
+		return pointers;
 	}
 
 	static MemoryPointerList Find(void *start_address, size_t search_length, const char *pattern) {
-		std::vector<MemoryPointer> pointers;
+		return Find(start_address, search_length, Signature(pattern));
+	}
 
-		// Generate pattern
-		std::vector<std::string> split_pattern = String::Split(pattern, " ");
-		std::string mask;
-		uint8_t *clean_pattern = new uint8_t[split_pattern.size()];
-		for (size_t i = 0; i < split_pattern.size(); i++) {
-			const char *byte_string = split_pattern[i].c_str();
-
-			// Convert to number
-			long byte = strtol(byte_string, nullptr, 16);
-			clean_pattern[i] = static_cast<uint8_t>(byte);
-
-			if (strcmp(byte_string, "??") == 0) {
-				mask.append("?");
-			} else {
-				mask.append("x");
+	// Searches the code of the process image
+	static MemoryPointerList Find(const char *pattern) {
+		Signature signature(pattern);
+		std::vector<MemoryPointer> pointers;
+		for (const ScanRange &range : GetCodeRanges()) {
+			for (const uint8_t *match : signature.FindAll(range.Start, range.Length)) {
+				pointers.push_back(const_cast<uint8_t *>(match));
 			}
 		}
+		return pointers;
+	}
 
-		void *current_address = Find(start_address, search_length, reinterpret_cast<const char *>(const_cast<const uint8_t *>(clean_pattern)), mask.c_str());
-		pointers.push_back(current_address);
-		while (current_address != nullptr && current_address < static_cast<char *>(start_address) + search_length) {
-			current_address = Find(static_cast<char *>(current_address) + 1, 
-				search_length - (reinterpret_cast<size_t>(current_address) - reinterpret_cast<size_t>(start_address)),
-				reinterpret_cast<const char *>(const_cast<const uint8_t *>(clean_pattern)), mask.c_str());
-			if (current_address != nullptr) {
-				pointers.push_back(current_address);
-			}
+	// First match of every signature in scanner, nullptr where there is none
+	static std::vector<void *> Find(const MultiScanner &scanner, void *start_address, size_t search_length) {
+		std::vector<void *> addresses;
+		for (const uint8_t *match : scanner.FindFirst(static_cast<const uint8_t *>(start_address), search_length)) {
+			addresses.push_back(const_cast<uint8_t *>(match));
 		}
+		return addresses;
+	}
 
-		delete[] clean_pattern;
-
-		return pointers;
+	// Same over several ranges, see MultiScanner::FindFirst
+	static std::vector<void *> Find(const MultiScanner &scanner, const std::vector<ScanRange> &ranges, size_t threads = 0) {
+		std::vector<void *> addresses;
+		for (const uint8_t *match : scanner.FindFirst(ranges, threads)) {
+			addresses.push_back(const_cast<uint8_t *>(match));
+		}
+		return addresses;
 	}
 
-	static MemoryPointerList Find(const char *pattern) {
-		return Find(GetProcessBaseAddress(), GetProcessImageSize(), pattern);
+	// Searches the code of the process image with up to threads workers
+	static std::vector<void *> Find(const MultiScanner &scanner, size_t threads = 0) {
+		return Find(scanner, GetCodeRanges(), threads);
 	}
 
 	static void Patch(int address, void *data, size_t size) {
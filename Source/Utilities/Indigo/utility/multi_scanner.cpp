@@ -0,0 +1,349 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "multi_scanner.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define INDIGO_SCANNER_X86
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(INDIGO_SCANNER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define INDIGO_TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define INDIGO_TARGET_SSE2
+#endif
+
+namespace indigo {
+struct ScanChunk {
+	const uint8_t *Start;
+	const uint8_t *Limit; // Matches have to start before this
+	const uint8_t *End; // and end before this
+};
+
+static const size_t kNotFound = static_cast<size_t>(-1);
+
+// Fixed runs are cut down to start at their rarest byte, but not below this
+static const size_t kMinFragment = 4;
+
+// Start and length of the run of fixed bytes a signature is found by: the
+// longest one, starting at a byte that is rare in code so the scan spends
+// little time away from the root
+static void scanner_fragment(const Signature &signature, size_t &offset, size_t &length) {
+	offset = 0;
+	length = 0;
+
+	size_t run = 0;
+	for (size_t i = 0; i < signature.GetLength(); i++) {
+		run = signature.IsFixed(i) ? run + 1 : 0;
+		if (run > length) {
+			offset = i + 1 - run;
+			length = run;
+		}
+	}
+
+	size_t end = offset + length;
+	for (size_t i = offset + 1; i + kMinFragment <= end; i++) {
+		if (PatternScanner::GetRank(signature.GetBytes()[i]) < PatternScanner::GetRank(signature.GetBytes()[offset])) {
+			offset = i;
+		}
+	}
+	length = end - offset;
+}
+
+// First position in [position, end) that holds one of the count values, or end
+#if defined(INDIGO_SCANNER_X86)
+INDIGO_TARGET_SSE2 static const uint8_t *scanner_skip(const uint8_t *position, const uint8_t *end, const uint8_t *values, size_t count) {
+	__m128i targets[MultiScanner::kMaxSkipValues];
+	for (size_t i = 0; i < count; i++) {
+		targets[i] = _mm_set1_epi8(static_cast<char>(values[i]));
+	}
+
+	for (; end - position >= 16; position += 16) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(position));
+		__m128i found = _mm_cmpeq_epi8(block, targets[0]);
+		for (size_t i = 1; i < count; i++) {
+			found = _mm_or_si128(found, _mm_cmpeq_epi8(block, targets[i]));
+		}
+
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(found));
+		if (mask != 0) {
+#if defined(_MSC_VER)
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			return position + bit;
+#else
+			return position + __builtin_ctz(mask);
+#endif
+		}
+	}
+
+	for (; position < end; position++) {
+		if (std::find(values, values + count, *position) != values + count) {
+			break;
+		}
+	}
+	return position;
+}
+#endif
+
+size_t MultiScanner::Add(const Signature &signature) {
+	entries_.push_back(Entry{ signature, false, 0 });
+	if (signature.GetLength() > max_length_) {
+		max_length_ = signature.GetLength();
+	}
+	return entries_.size() - 1;
+}
+
+void MultiScanner::Compile() {
+	next_.assign(256, 0);
+	outputs_.assign(1, std::vector<uint32_t>());
+
+	// Trie of the fixed runs. While it is built 0 means there is no child, which
+	// works since nothing leads back to the root yet.
+	for (size_t i = 0; i < entries_.size(); i++) {
+		const Signature &signature = entries_[i].Pattern;
+
+		size_t offset, length;
+		scanner_fragment(signature, offset, length);
+		if (length == 0) {
+			continue;
+		}
+		entries_[i].Scanned = true;
+		entries_[i].FragmentEnd = offset + length - 1;
+
+		uint32_t state = 0;
+		for (size_t j = offset; j < offset + length; j++) {
+			uint32_t &child = next_[state * 256 + signature.GetBytes()[j]];
+			if (child == 0) {
+				child = static_cast<uint32_t>(outputs_.size());
+				outputs_.emplace_back();
+				next_.resize(next_.size() + 256, 0);
+			}
+			// next_ may have moved
+			state = next_[state * 256 + signature.GetBytes()[j]];
+		}
+		outputs_[state].push_back(static_cast<uint32_t>(i));
+	}
+
+	// Bytes that leave the root, the scan jumps between them while it is there
+	first_bytes_.clear();
+	for (uint32_t value = 0; value < 256; value++) {
+		if (next_[value] != 0) {
+			first_bytes_.push_back(static_cast<uint8_t>(value));
+		}
+	}
+
+	// Breadth first, every state gets its failure state and missing transitions
+	// are filled in from it, which turns the trie into a full automaton
+	size_t states = outputs_.size();
+	std::vector<uint32_t> failure(states, 0);
+	output_link_.assign(states, 0);
+	terminal_.assign(states, 0);
+
+	std::deque<uint32_t> queue;
+	for (uint32_t value = 0; value < 256; value++) {
+		if (next_[value] != 0) {
+			queue.push_back(next_[value]);
+		}
+	}
+
+	while (!queue.empty()) {
+		uint32_t state = queue.front();
+		queue.pop_front();
+
+		uint32_t fallback = failure[state];
+		output_link_[state] = outputs_[fallback].empty() ? output_link_[fallback] : fallback;
+		terminal_[state] = !outputs_[state].empty() || output_link_[state] != 0;
+
+		for (uint32_t value = 0; value < 256; value++) {
+			uint32_t &child = next_[state * 256 + value];
+			if (child != 0) {
+				failure[child] = next_[fallback * 256 + value];
+				queue.push_back(child);
+			} else {
+				child = next_[fallback * 256 + value];
+			}
+		}
+	}
+}
+
+void MultiScanner::Scan(const uint8_t *start, const uint8_t *limit, const uint8_t *end,
+	const std::function<bool(size_t, const uint8_t *)> &match) const {
+	if (next_.empty()) {
+		return;
+	}
+
+	const uint32_t *next = next_.data();
+	const uint8_t *terminal = terminal_.data();
+	uint32_t state = 0;
+
+#if defined(INDIGO_SCANNER_X86)
+	bool skip = first_bytes_.size() <= kMaxSkipValues && PatternScanner::GetLevel() >= kScannerLevel_SSE2;
+#endif
+
+	for (const uint8_t *position = start; position < end; position++) {
+#if defined(INDIGO_SCANNER_X86)
+		if (state == 0 && skip) {
+			position = scanner_skip(position, end, first_bytes_.data(), first_bytes_.size());
+			if (position == end) {
+				break;
+			}
+		}
+#endif
+		state = next[state * 256 + *position];
+		if (!terminal[state]) {
+			continue;
+		}
+
+		// A run ends at position, check every signature it belongs to
+		for (uint32_t output = state; output != 0; output = output_link_[output]) {
+			for (uint32_t index : outputs_[output]) {
+				const Entry &entry = entries_[index];
+
+				// Candidate start, without stepping in front of start
+				if (static_cast<size_t>(position - start) < entry.FragmentEnd) {
+					continue;
+				}
+				const uint8_t *candidate = position - entry.FragmentEnd;
+				if (candidate >= limit || static_cast<size_t>(end - candidate) < entry.Pattern.GetLength()) {
+					continue;
+				}
+
+				if (entry.Pattern.Matches(candidate) && !match(index, candidate)) {
+					return;
+				}
+			}
+		}
+	}
+}
+
+void MultiScanner::Scan(const uint8_t *start, size_t length, const std::function<void(size_t, const uint8_t *)> &match) const {
+	Scan(start, start + length, start + length, [&](size_t index, const uint8_t *address) {
+		match(index, address);
+		return true;
+	});
+}
+
+std::vector<const uint8_t *> MultiScanner::FindFirst(const uint8_t *start, size_t length) const {
+	std::vector<const uint8_t *> matches(entries_.size(), nullptr);
+
+	// Signatures that can't match are left out
+	size_t remaining = 0;
+	for (const Entry &entry : entries_) {
+		if (entry.Scanned && entry.Pattern.GetLength() <= length) {
+			remaining++;
+		}
+	}
+	if (remaining == 0) {
+		return matches;
+	}
+
+	// The fixed run is at the same offset in every match of a signature, so
+	// its matches are reported in memory order and the first one is kept
+	Scan(start, start + length, start + length, [&](size_t index, const uint8_t *address) {
+		if (matches[index] == nullptr) {
+			matches[index] = address;
+			remaining--;
+		}
+		return remaining > 0;
+	});
+
+	return matches;
+}
+
+std::vector<const uint8_t *> MultiScanner::FindFirst(const std::vector<ScanRange> &ranges, size_t threads) const {
+	// Chunks overlap by one byte less than the longest signature and a match
+	// belongs to the chunk it starts in. Matches can't cross into another range.
+	std::vector<ScanChunk> chunks;
+	size_t overlap = max_length_ > 0 ? max_length_ - 1 : 0;
+	for (const ScanRange &range : ranges) {
+		const uint8_t *range_end = range.Start + range.Length;
+		for (size_t offset = 0; offset < range.Length; offset += kChunkSize) {
+			ScanChunk chunk;
+			chunk.Start = range.Start + offset;
+			chunk.Limit = range.Length - offset > kChunkSize ? chunk.Start + kChunkSize : range_end;
+			chunk.End = static_cast<size_t>(range_end - chunk.Limit) > overlap ? chunk.Limit + overlap : range_end;
+			chunks.push_back(chunk);
+		}
+	}
+
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	if (threads > chunks.size()) {
+		threads = chunks.size();
+	}
+
+	// Lowest chunk every signature was found in so far
+	size_t count = entries_.size();
+	std::unique_ptr<std::atomic<size_t>[]> found(new std::atomic<size_t>[count]);
+	for (size_t i = 0; i < count; i++) {
+		found[i].store(kNotFound, std::memory_order_relaxed);
+	}
+
+	std::vector<std::vector<const uint8_t *>> matches(chunks.size());
+	std::atomic<size_t> next_chunk(0);
+
+	auto worker = [&]() {
+		std::vector<uint8_t> wanted(count);
+		size_t chunk;
+		while ((chunk = next_chunk.fetch_add(1, std::memory_order_relaxed)) < chunks.size()) {
+			// Signatures that weren't found in an earlier chunk yet
+			size_t remaining = 0;
+			for (size_t i = 0; i < count; i++) {
+				wanted[i] = entries_[i].Scanned && found[i].load(std::memory_order_relaxed) > chunk;
+				remaining += wanted[i];
+			}
+			if (remaining == 0) {
+				continue;
+			}
+
+			std::vector<const uint8_t *> &first = matches[chunk];
+			first.assign(count, nullptr);
+			Scan(chunks[chunk].Start, chunks[chunk].Limit, chunks[chunk].End, [&](size_t index, const uint8_t *address) {
+				if (wanted[index] && first[index] == nullptr) {
+					first[index] = address;
+					remaining--;
+
+					size_t current = found[index].load(std::memory_order_relaxed);
+					while (current > chunk && !found[index].compare_exchange_weak(current, chunk, std::memory_order_relaxed)) {
+					}
+				}
+				return remaining > 0;
+			});
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; i++) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &thread : workers) {
+		thread.join();
+	}
+
+	std::vector<const uint8_t *> result(count, nullptr);
+	for (size_t i = 0; i < count; i++) {
+		size_t chunk = found[i].load(std::memory_order_relaxed);
+		if (chunk != kNotFound) {
+			result[i] = matches[chunk][i];
+		}
+	}
+	return result;
+}
+}
@@ -0,0 +1,106 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef INDIGO_UTILITY_MULTI_SCANNER_H_
+#define INDIGO_UTILITY_MULTI_SCANNER_H_
+
+#include "signature.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+namespace indigo {
+// A block of memory to scan
+struct ScanRange {
+	const uint8_t *Start;
+	size_t Length;
+};
+
+// Finds any number of signatures in a single pass over memory. A run of fixed
+// bytes of every signature goes into an Aho-Corasick automaton, and whenever
+// a run is seen the signatures it belongs to are checked at the matching
+// position. Signatures without fixed bytes are ignored.
+// Example:
+//    MultiScanner scanner;
+//    size_t setopt = scanner.Add(Signature("55 8B EC ?? 8B 45 08"));
+//    size_t close = scanner.Add(Signature("56 57 8B 7C 24 0C"));
+//    scanner.Compile();
+//    std::vector<const uint8_t *> matches = scanner.FindFirst(start, length);
+class MultiScanner {
+	struct Entry {
+		Signature Pattern;
+		bool Scanned; // Has fixed bytes
+		size_t FragmentEnd; // Offset of the last byte of the fixed run
+	};
+
+	std::vector<Entry> entries_;
+	size_t max_length_;
+
+	// The automaton as a full transition table, 256 entries per state. State 0
+	// is the root.
+	std::vector<uint32_t> next_;
+	std::vector<std::vector<uint32_t>> outputs_; // Entries whose run ends in a state
+	std::vector<uint32_t> output_link_; // Nearest shorter suffix state with outputs
+	std::vector<uint8_t> terminal_; // Whether a state or a suffix of it has outputs
+	std::vector<uint8_t> first_bytes_; // Bytes that have a transition from the root
+
+	// Calls match for every match that starts before limit and lies within
+	// [start, end), stopping when it returns false
+	void Scan(const uint8_t *start, const uint8_t *limit, const uint8_t *end,
+		const std::function<bool(size_t, const uint8_t *)> &match) const;
+
+public:
+	// While the automaton is in the root state, bytes that can't start a fixed
+	// run are skipped with vector compares if there are at most this many
+	// different first bytes
+	static const size_t kMaxSkipValues = 4;
+
+	// Ranges are split into chunks of this size for parallel scans
+	static const size_t kChunkSize = 512 * 1024;
+
+	MultiScanner() : max_length_(0) {
+	}
+
+	// Returns the index matches of this signature are reported with
+	size_t Add(const Signature &signature);
+
+	// Builds the automaton, needs to be called after the last Add
+	void Compile();
+
+	size_t GetCount() const {
+		return entries_.size();
+	}
+
+	const Signature &Get(size_t index) const {
+		return entries_[index].Pattern;
+	}
+
+	// Longest signature, neighbouring ranges that are scanned separately have to
+	// overlap by one byte less than this
+	size_t GetMaxLength() const {
+		return max_length_;
+	}
+
+	// Calls match with the index and address of every match within
+	// [start, start + length), in order of the end of their fixed run
+	void Scan(const uint8_t *start, size_t length, const std::function<void(size_t, const uint8_t *)> &match) const;
+
+	// First match of every signature, nullptr for the ones that weren't found.
+	// The scan stops as soon as every signature has been found.
+	std::vector<const uint8_t *> FindFirst(const uint8_t *start, size_t length) const;
+
+	// Same over several ranges, a match in an earlier range comes first. Ranges
+	// are cut into overlapping chunks that up to threads workers scan at once,
+	// 0 uses one per core. A worker skips chunks after the first match of every
+	// signature.
+	std::vector<const uint8_t *> FindFirst(const std::vector<ScanRange> &ranges, size_t threads = 0) const;
+};
+}
+
+#endif // INDIGO_UTILITY_MULTI_SCANNER_H_
@@ -0,0 +1,251 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "pattern_scanner.hpp"
+#include <string.h>
+#include <algorithm>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define INDIGO_SCANNER_X86
+#include <immintrin.h>
+#if !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions marked for it, MSVC
+// emits them anywhere
+#if defined(INDIGO_SCANNER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define INDIGO_TARGET_SSE2 __attribute__((target("sse2")))
+#define INDIGO_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define INDIGO_TARGET_SSE2
+#define INDIGO_TARGET_AVX2
+#endif
+
+namespace indigo {
+// Bytes that are common in x86 code, most common first. A byte that isn't
+// listed is assumed to be rarer than all of them.
+static const uint8_t kCommonCodeBytes[] = {
+	0x00, 0xFF, 0x8B, 0x48, 0x89, 0x24, 0xCC, 0x44, 0x0F, 0x4C, 0xE8, 0x83, 0x45, 0x8D, 0x01, 0x85,
+	0x74, 0x75, 0xC3, 0x08, 0x10, 0x04, 0xC0, 0x5C, 0x55, 0x50, 0x20, 0x0C, 0x40, 0x90, 0x33, 0xC7,
+	0x41, 0x49, 0x4D, 0x8E, 0x18, 0x30, 0x6C, 0x54, 0x0D, 0x02, 0xE9, 0xEB, 0x3B, 0x84, 0x80, 0x38
+};
+
+size_t PatternScanner::GetRank(uint8_t value) {
+	for (size_t i = 0; i < sizeof(kCommonCodeBytes); i++) {
+		if (kCommonCodeBytes[i] == value) {
+			return sizeof(kCommonCodeBytes) - i;
+		}
+	}
+	return 0;
+}
+
+#if defined(INDIGO_SCANNER_X86)
+static void scanner_cpuid(int registers[4], int leaf) {
+#if defined(_MSC_VER)
+	__cpuidex(registers, leaf, 0);
+#else
+	unsigned int eax, ebx, ecx, edx;
+	__cpuid_count(leaf, 0, eax, ebx, ecx, edx);
+	registers[0] = static_cast<int>(eax);
+	registers[1] = static_cast<int>(ebx);
+	registers[2] = static_cast<int>(ecx);
+	registers[3] = static_cast<int>(edx);
+#endif
+}
+
+static ScannerLevel scanner_detect() {
+	int registers[4];
+	scanner_cpuid(registers, 0);
+	int leaves = registers[0];
+
+	scanner_cpuid(registers, 1);
+	bool sse2 = (registers[3] & (1 << 26)) != 0;
+	bool osxsave = (registers[2] & (1 << 27)) != 0;
+	bool avx = (registers[2] & (1 << 28)) != 0;
+
+	// AVX2 also needs the OS to save the YMM registers
+	bool avx2 = false;
+	if (leaves >= 7 && osxsave && avx) {
+#if defined(_MSC_VER)
+		uint64_t xcr0 = _xgetbv(0);
+#else
+		uint32_t xcr0_low, xcr0_high;
+		__asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+		uint64_t xcr0 = (static_cast<uint64_t>(xcr0_high) << 32) | xcr0_low;
+#endif
+		scanner_cpuid(registers, 7);
+		avx2 = (xcr0 & 0x6) == 0x6 && (registers[1] & (1 << 5)) != 0;
+	}
+
+	return avx2 ? kScannerLevel_AVX2 : sse2 ? kScannerLevel_SSE2 : kScannerLevel_Scalar;
+}
+#endif
+
+// Index of the lowest set bit, which is cleared
+static uint32_t scanner_next_bit(uint32_t &mask) {
+#if defined(_MSC_VER)
+	unsigned long bit;
+	_BitScanForward(&bit, mask);
+#elif defined(__GNUC__) || defined(__clang__)
+	uint32_t bit = static_cast<uint32_t>(__builtin_ctz(mask));
+#else
+	uint32_t bit = 0;
+	while (!(mask & (1u << bit))) {
+		bit++;
+	}
+#endif
+	mask &= mask - 1;
+	return static_cast<uint32_t>(bit);
+}
+
+PatternScanner::PatternScanner(const uint8_t *pattern, const char *mask) : length_(strlen(mask)), anchors_(0) {
+	for (size_t i = 0; i < length_; i++) {
+		if (mask[i] != '?') {
+			fixed_.push_back(FixedByte{ i, pattern[i] });
+		}
+	}
+	SelectAnchors();
+}
+
+PatternScanner::PatternScanner(const uint8_t *pattern, const bool *fixed, size_t length) : length_(length), anchors_(0) {
+	for (size_t i = 0; i < length_; i++) {
+		if (fixed[i]) {
+			fixed_.push_back(FixedByte{ i, pattern[i] });
+		}
+	}
+	SelectAnchors();
+}
+
+void PatternScanner::SelectAnchors() {
+	// Rarest fixed bytes first, the first two are the anchors
+	std::stable_sort(fixed_.begin(), fixed_.end(), [](const FixedByte &left, const FixedByte &right) {
+		return GetRank(left.Value) < GetRank(right.Value);
+	});
+	anchors_ = fixed_.size() < 2 ? fixed_.size() : 2;
+}
+
+ScannerLevel PatternScanner::GetLevel() {
+#if defined(INDIGO_SCANNER_X86)
+	static const ScannerLevel level = scanner_detect();
+	return level;
+#else
+	return kScannerLevel_Scalar;
+#endif
+}
+
+const uint8_t *PatternScanner::Find(const uint8_t *start, size_t length) const {
+	if (length_ == 0 || length < length_) {
+		return nullptr;
+	}
+
+	// Only wildcards, anything matches
+	if (fixed_.empty()) {
+		return start;
+	}
+
+	// end is one past the last position a match can start at
+	const uint8_t *end = start + (length - length_) + 1;
+
+	switch (GetLevel()) {
+	case kScannerLevel_AVX2:
+		return FindAVX2(start, end);
+	case kScannerLevel_SSE2:
+		return FindSSE2(start, end);
+	default:
+		return FindScalar(start, end);
+	}
+}
+
+const uint8_t *PatternScanner::FindScalar(const uint8_t *start, const uint8_t *end) const {
+	const FixedByte &anchor = fixed_[0];
+	for (const uint8_t *position = start; position < end; position++) {
+		// memchr for the rarest byte is usually vectorized by the C library
+		const uint8_t *found = static_cast<const uint8_t *>(memchr(position + anchor.Offset, anchor.Value, end - position));
+		if (found == nullptr) {
+			return nullptr;
+		}
+		position = found - anchor.Offset;
+
+		bool matches = true;
+		for (size_t i = 1; i < fixed_.size(); i++) {
+			if (position[fixed_[i].Offset] != fixed_[i].Value) {
+				matches = false;
+				break;
+			}
+		}
+		if (matches) {
+			return position;
+		}
+	}
+	return nullptr;
+}
+
+#if defined(INDIGO_SCANNER_X86)
+INDIGO_TARGET_SSE2 const uint8_t *PatternScanner::FindSSE2(const uint8_t *start, const uint8_t *end) const {
+	// With a single fixed byte both anchors are the same
+	const FixedByte &first = fixed_[0];
+	const FixedByte &second = fixed_[anchors_ - 1];
+	__m128i first_value = _mm_set1_epi8(static_cast<char>(first.Value));
+	__m128i second_value = _mm_set1_epi8(static_cast<char>(second.Value));
+
+	const uint8_t *position = start;
+	for (; end - position >= 16; position += 16) {
+		__m128i first_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(position + first.Offset));
+		__m128i second_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(position + second.Offset));
+		uint32_t candidates = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first_block, first_value), _mm_cmpeq_epi8(second_block, second_value))));
+
+		while (candidates != 0) {
+			const uint8_t *candidate = position + scanner_next_bit(candidates);
+			if (Matches(candidate)) {
+				return candidate;
+			}
+		}
+	}
+
+	return position < end ? FindScalar(position, end) : nullptr;
+}
+
+INDIGO_TARGET_AVX2 const uint8_t *PatternScanner::FindAVX2(const uint8_t *start, const uint8_t *end) const {
+	const FixedByte &first = fixed_[0];
+	const FixedByte &second = fixed_[anchors_ - 1];
+	__m256i first_value = _mm256_set1_epi8(static_cast<char>(first.Value));
+	__m256i second_value = _mm256_set1_epi8(static_cast<char>(second.Value));
+
+	const uint8_t *position = start;
+	for (; end - position >= 32; position += 32) {
+		__m256i first_block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + first.Offset));
+		__m256i second_block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + second.Offset));
+		uint32_t candidates = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(first_block, first_value), _mm256_cmpeq_epi8(second_block, second_value))));
+
+		while (candidates != 0) {
+			const uint8_t *candidate = position + scanner_next_bit(candidates);
+			if (Matches(candidate)) {
+				return candidate;
+			}
+		}
+	}
+
+	return position < end ? FindScalar(position, end) : nullptr;
+}
+#else
+const uint8_t *PatternScanner::FindSSE2(const uint8_t *start, const uint8_t *end) const {
+	return FindScalar(start, end);
+}
+
+const uint8_t *PatternScanner::FindAVX2(const uint8_t *start, const uint8_t *end) const {
+	return FindScalar(start, end);
+}
+#endif
+}
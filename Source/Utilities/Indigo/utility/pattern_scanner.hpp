@@ -0,0 +1,82 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef INDIGO_UTILITY_PATTERN_SCANNER_H_
+#define INDIGO_UTILITY_PATTERN_SCANNER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace indigo {
+enum ScannerLevel {
+	kScannerLevel_Scalar,
+	kScannerLevel_SSE2,
+	kScannerLevel_AVX2
+};
+
+// Finds a byte pattern with wildcards in memory. The two fixed bytes of the
+// pattern that are least common in x86 code are the anchors: a vector pass
+// compares 16 (SSE2) or 32 (AVX2) positions at once against both anchors and
+// only positions where both match are checked against the whole pattern. The
+// instruction set is picked at runtime.
+// Example:
+//    PatternScanner scanner(reinterpret_cast<const uint8_t *>("\x8B\x00\xE8"), "x?x");
+//    const uint8_t *match = scanner.Find(start, length);
+class PatternScanner {
+	struct FixedByte {
+		size_t Offset;
+		uint8_t Value;
+	};
+
+	size_t length_;
+	std::vector<FixedByte> fixed_; // Every fixed byte, anchors first
+	size_t anchors_; // 0, 1 or 2
+
+	void SelectAnchors();
+	const uint8_t *FindScalar(const uint8_t *start, const uint8_t *end) const;
+	const uint8_t *FindSSE2(const uint8_t *start, const uint8_t *end) const;
+	const uint8_t *FindAVX2(const uint8_t *start, const uint8_t *end) const;
+
+	bool Matches(const uint8_t *position) const {
+		for (size_t i = anchors_; i < fixed_.size(); i++) {
+			if (position[fixed_[i].Offset] != fixed_[i].Value) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+	// Matches nothing
+	PatternScanner() : length_(0), anchors_(0) {
+	}
+
+	// mask has one character per pattern byte, '?' is a wildcard and anything
+	// else has to match, like Memory::Find
+	PatternScanner(const uint8_t *pattern, const char *mask);
+
+	// Same with an explicit length, wildcard bytes are false in fixed
+	PatternScanner(const uint8_t *pattern, const bool *fixed, size_t length);
+
+	// First match that lies entirely within [start, start + length), or nullptr
+	const uint8_t *Find(const uint8_t *start, size_t length) const;
+
+	size_t GetLength() const {
+		return length_;
+	}
+
+	// Instruction set Find uses on this machine
+	static ScannerLevel GetLevel();
+
+	// How common a byte is in x86 code, 0 for the rare ones
+	static size_t GetRank(uint8_t value);
+};
+}
+
+#endif // INDIGO_UTILITY_PATTERN_SCANNER_H_
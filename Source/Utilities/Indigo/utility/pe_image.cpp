@@ -0,0 +1,331 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "pe_image.hpp"
+#include <string.h>
+#include <algorithm>
+
+namespace indigo {
+// Offsets into the headers, the same for PE32 and PE32+ unless noted
+static const size_t kDosLfanew = 0x3C;
+static const size_t kFileHeaderSize = 20;
+static const size_t kFileSections = 2;
+static const size_t kFileTimeDateStamp = 4;
+static const size_t kFileOptionalSize = 16;
+static const size_t kOptionalImageBase32 = 28;
+static const size_t kOptionalImageBase64 = 24;
+static const size_t kOptionalSizeOfImage = 56;
+static const size_t kOptionalSizeOfHeaders = 60;
+static const size_t kOptionalDirectoryCount32 = 92;
+static const size_t kOptionalDirectoryCount64 = 108;
+static const size_t kSectionSize = 40;
+static const uint16_t kMagicPE32 = 0x10B;
+static const uint16_t kMagicPE64 = 0x20B;
+static const uint32_t kDirectoryRelocations = 5;
+static const uint32_t kDirectoryIAT = 12;
+static const uint32_t kPageSize = 0x1000;
+
+template<typename _TValue>
+static bool pe_read(const uint8_t *data, size_t size, size_t offset, _TValue &value) {
+	if (offset > size || size - offset < sizeof(_TValue)) {
+		return false;
+	}
+	memcpy(&value, data + offset, sizeof(_TValue));
+	return true;
+}
+
+// Multiply-xorshift over 8 byte words, several GB/s
+static uint64_t pe_hash(uint64_t hash, const uint8_t *data, size_t size) {
+	const uint64_t kMultiplier = 0x9E3779B97F4A7C15ULL;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * kMultiplier;
+		hash ^= hash >> 32;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ data[i]) * kMultiplier;
+	}
+	return hash;
+}
+
+PEImage::PEImage(const void *data, size_t size, PEImageLayout layout)
+	: data_(static_cast<const uint8_t *>(data)), size_(size), layout_(layout), valid_(false), time_date_stamp_(0), size_of_image_(0),
+	size_of_headers_(0), image_base_(0), relocations_rva_(0), relocations_size_(0), iat_rva_(0), iat_size_(0) {
+	valid_ = data_ != nullptr && Parse();
+	if (!valid_) {
+		sections_.clear();
+	}
+}
+
+bool PEImage::Parse() {
+	uint16_t dos_magic;
+	uint32_t nt_offset;
+	if (!pe_read(data_, size_, 0, dos_magic) || dos_magic != 0x5A4D || !pe_read(data_, size_, kDosLfanew, nt_offset)) {
+		return false;
+	}
+
+	uint32_t nt_signature;
+	if (!pe_read(data_, size_, nt_offset, nt_signature) || nt_signature != 0x00004550) {
+		return false;
+	}
+
+	size_t file_header = nt_offset + 4;
+	uint16_t section_count, optional_size;
+	if (!pe_read(data_, size_, file_header + kFileSections, section_count) ||
+		!pe_read(data_, size_, file_header + kFileTimeDateStamp, time_date_stamp_) ||
+		!pe_read(data_, size_, file_header + kFileOptionalSize, optional_size)) {
+		return false;
+	}
+
+	size_t optional_header = file_header + kFileHeaderSize;
+	uint16_t magic;
+	if (!pe_read(data_, size_, optional_header, magic) || (magic != kMagicPE32 && magic != kMagicPE64)) {
+		return false;
+	}
+
+	size_t directory_count_offset;
+	if (magic == kMagicPE32) {
+		uint32_t image_base;
+		if (!pe_read(data_, size_, optional_header + kOptionalImageBase32, image_base)) {
+			return false;
+		}
+		image_base_ = image_base;
+		directory_count_offset = kOptionalDirectoryCount32;
+	} else {
+		if (!pe_read(data_, size_, optional_header + kOptionalImageBase64, image_base_)) {
+			return false;
+		}
+		directory_count_offset = kOptionalDirectoryCount64;
+	}
+
+	if (!pe_read(data_, size_, optional_header + kOptionalSizeOfImage, size_of_image_) ||
+		!pe_read(data_, size_, optional_header + kOptionalSizeOfHeaders, size_of_headers_)) {
+		return false;
+	}
+
+	// Data directories follow their count, each is an RVA and a size
+	uint32_t directory_count;
+	if (!pe_read(data_, size_, optional_header + directory_count_offset, directory_count)) {
+		return false;
+	}
+	size_t directories = optional_header + directory_count_offset + 4;
+	if (directory_count > kDirectoryRelocations) {
+		pe_read(data_, size_, directories + kDirectoryRelocations * 8, relocations_rva_);
+		pe_read(data_, size_, directories + kDirectoryRelocations * 8 + 4, relocations_size_);
+	}
+	if (directory_count > kDirectoryIAT) {
+		pe_read(data_, size_, directories + kDirectoryIAT * 8, iat_rva_);
+		pe_read(data_, size_, directories + kDirectoryIAT * 8 + 4, iat_size_);
+	}
+
+	size_t section_table = optional_header + optional_size;
+	for (uint16_t i = 0; i < section_count; i++) {
+		size_t offset = section_table + i * kSectionSize;
+
+		PESection section;
+		if (offset > size_ || size_ - offset < kSectionSize) {
+			return false;
+		}
+		const char *name = reinterpret_cast<const char *>(data_ + offset);
+		section.Name = std::string(name, std::find(name, name + 8, '\0'));
+		pe_read(data_, size_, offset + 8, section.VirtualSize);
+		pe_read(data_, size_, offset + 12, section.VirtualAddress);
+		pe_read(data_, size_, offset + 16, section.RawSize);
+		pe_read(data_, size_, offset + 20, section.RawOffset);
+		pe_read(data_, size_, offset + 36, section.Characteristics);
+		sections_.push_back(section);
+	}
+
+	return true;
+}
+
+const uint8_t *PEImage::GetPointer(uint32_t rva, size_t size) const {
+	if (!valid_) {
+		return nullptr;
+	}
+
+	if (layout_ == kPEImageLayout_Loaded) {
+		return rva <= size_ && size_ - rva >= size ? data_ + rva : nullptr;
+	}
+
+	// The headers are at the same offset in the file
+	if (rva < size_of_headers_) {
+		return size_of_headers_ - rva >= size && rva <= size_ && size_ - rva >= size ? data_ + rva : nullptr;
+	}
+
+	for (const PESection &section : sections_) {
+		if (rva < section.VirtualAddress || rva - section.VirtualAddress >= GetFileBackedSize(section)) {
+			continue;
+		}
+
+		uint32_t offset = rva - section.VirtualAddress;
+		if (GetFileBackedSize(section) - offset < size) {
+			return nullptr;
+		}
+
+		size_t file_offset = static_cast<size_t>(section.RawOffset) + offset;
+		return file_offset <= size_ && size_ - file_offset >= size ? data_ + file_offset : nullptr;
+	}
+
+	return nullptr;
+}
+
+bool PEImage::GetRVA(const void *address, uint32_t &rva) const {
+	const uint8_t *pointer = static_cast<const uint8_t *>(address);
+	if (!valid_ || pointer < data_ || pointer >= data_ + size_) {
+		return false;
+	}
+	size_t offset = static_cast<size_t>(pointer - data_);
+
+	if (layout_ == kPEImageLayout_Loaded) {
+		rva = static_cast<uint32_t>(offset);
+		return true;
+	}
+
+	if (offset < size_of_headers_) {
+		rva = static_cast<uint32_t>(offset);
+		return true;
+	}
+
+	for (const PESection &section : sections_) {
+		if (offset >= section.RawOffset && offset - section.RawOffset < GetFileBackedSize(section)) {
+			rva = section.VirtualAddress + static_cast<uint32_t>(offset - section.RawOffset);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::vector<ScanRange> PEImage::GetCodeRanges() const {
+	std::vector<ScanRange> ranges;
+	for (const PESection &section : sections_) {
+		if (!section.IsExecutable()) {
+			continue;
+		}
+
+		uint32_t length = layout_ == kPEImageLayout_Loaded ? (section.VirtualSize != 0 ? section.VirtualSize : section.RawSize) : GetFileBackedSize(section);
+		const uint8_t *start = GetPointer(section.VirtualAddress, length);
+		if (start != nullptr && length > 0) {
+			ranges.push_back(ScanRange{ start, length });
+		}
+	}
+	return ranges;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> PEImage::GetLoaderPatches() const {
+	std::vector<std::pair<uint32_t, uint32_t>> patches;
+
+	if (iat_rva_ != 0 && iat_size_ != 0) {
+		patches.push_back(std::make_pair(iat_rva_, iat_size_));
+	}
+
+	// Base relocation blocks: page RVA, block size, then 16 bit entries with the
+	// type in the top 4 bits and the offset into the page below
+	const uint8_t *relocations = relocations_size_ > 0 ? GetPointer(relocations_rva_, relocations_size_) : nullptr;
+	size_t offset = 0;
+	while (relocations != nullptr && relocations_size_ - offset >= 8) {
+		uint32_t page, block_size;
+		memcpy(&page, relocations + offset, sizeof(page));
+		memcpy(&block_size, relocations + offset + 4, sizeof(block_size));
+		if (block_size < 8 || block_size > relocations_size_ - offset) {
+			break;
+		}
+
+		for (size_t entry_offset = 8; entry_offset + 2 <= block_size; entry_offset += 2) {
+			uint16_t entry;
+			memcpy(&entry, relocations + offset + entry_offset, sizeof(entry));
+
+			uint32_t size;
+			switch (entry >> 12) {
+			case 1: // HIGH
+			case 2: // LOW
+				size = 2;
+				break;
+			case 3: // HIGHLOW
+				size = 4;
+				break;
+			case 10: // DIR64
+				size = 8;
+				break;
+			default: // ABSOLUTE is padding, the rest don't occur on x86
+				size = 0;
+				break;
+			}
+			if (size != 0) {
+				patches.push_back(std::make_pair(page + (entry & 0xFFF), size));
+			}
+		}
+
+		offset += block_size;
+	}
+
+	std::sort(patches.begin(), patches.end());
+	return patches;
+}
+
+uint64_t PEImage::GetCodeHash() const {
+	if (!valid_) {
+		return 0;
+	}
+
+	std::vector<std::pair<uint32_t, uint32_t>> patches = GetLoaderPatches();
+	uint8_t page[kPageSize];
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (const PESection &section : sections_) {
+		if (!section.IsExecutable()) {
+			continue;
+		}
+
+		uint32_t length = GetFileBackedSize(section);
+		const uint8_t *start = GetPointer(section.VirtualAddress, length);
+		if (start == nullptr) {
+			continue;
+		}
+		hash = pe_hash(hash, reinterpret_cast<const uint8_t *>(&section.VirtualAddress), sizeof(section.VirtualAddress));
+		hash = pe_hash(hash, reinterpret_cast<const uint8_t *>(&length), sizeof(length));
+		std::vector<std::pair<uint32_t, uint32_t>>::const_iterator patch = patches.begin();
+
+		// A page at a time, with whatever the loader patches zeroed
+		for (uint32_t offset = 0; offset < length; offset += kPageSize) {
+			uint32_t page_rva = section.VirtualAddress + offset;
+			uint32_t page_size = length - offset < kPageSize ? length - offset : kPageSize;
+			memcpy(page, start + offset, page_size);
+
+			// Patches are sorted, skip the ones that end before this page
+			while (patch != patches.end() && static_cast<uint64_t>(patch->first) + patch->second <= page_rva) {
+				++patch;
+			}
+			for (std::vector<std::pair<uint32_t, uint32_t>>::const_iterator current = patch;
+				current != patches.end() && current->first < page_rva + page_size; ++current) {
+				uint64_t patch_end = static_cast<uint64_t>(current->first) + current->second;
+				uint32_t from = current->first > page_rva ? current->first - page_rva : 0;
+				uint32_t to = patch_end < page_rva + page_size ? static_cast<uint32_t>(patch_end - page_rva) : page_size;
+				if (from < to) {
+					memset(page + from, 0, to - from);
+				}
+			}
+
+			hash = pe_hash(hash, page, page_size);
+		}
+	}
+
+	return hash;
+}
+
+ModuleIdentity PEImage::GetIdentity() const {
+	ModuleIdentity identity;
+	identity.TimeDateStamp = time_date_stamp_;
+	identity.SizeOfImage = size_of_image_;
+	identity.CodeHash = GetCodeHash();
+	return identity;
+}
+}
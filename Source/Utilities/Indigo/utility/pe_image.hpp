@@ -0,0 +1,138 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef INDIGO_UTILITY_PE_IMAGE_H_
+#define INDIGO_UTILITY_PE_IMAGE_H_
+
+#include "multi_scanner.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace indigo {
+enum PEImageLayout {
+	kPEImageLayout_Loaded, // Mapped by the loader, RVAs are offsets from the base
+	kPEImageLayout_File // Read from disk, sections are at their raw offsets
+};
+
+struct PESection {
+	static const uint32_t kCode = 0x00000020; // IMAGE_SCN_CNT_CODE
+	static const uint32_t kExecute = 0x20000000; // IMAGE_SCN_MEM_EXECUTE
+
+	std::string Name;
+	uint32_t VirtualAddress;
+	uint32_t VirtualSize;
+	uint32_t RawOffset;
+	uint32_t RawSize;
+	uint32_t Characteristics;
+
+	bool IsExecutable() const {
+		return (Characteristics & (kCode | kExecute)) != 0;
+	}
+};
+
+// What a module is recognized by across runs. CodeHash covers the executable
+// sections as they are stored in the file, with the bytes the loader patches
+// (relocations and the import address table) left out, so a loaded image and
+// its file on disk give the same identity wherever the image was loaded.
+struct ModuleIdentity {
+	uint32_t TimeDateStamp;
+	uint32_t SizeOfImage;
+	uint64_t CodeHash;
+
+	bool operator==(const ModuleIdentity &other) const {
+		return TimeDateStamp == other.TimeDateStamp && SizeOfImage == other.SizeOfImage && CodeHash == other.CodeHash;
+	}
+
+	bool operator!=(const ModuleIdentity &other) const {
+		return !(*this == other);
+	}
+};
+
+// Read-only view of a PE32 or PE32+ image, either loaded or as a file. Every
+// read is bounds checked, so a truncated or malformed image only makes the
+// view invalid.
+// Example:
+//    PEImage image(Memory::GetProcessBaseAddress(), Memory::GetProcessImageSize(), kPEImageLayout_Loaded);
+//    ModuleIdentity identity = image.GetIdentity();
+class PEImage {
+	const uint8_t *data_;
+	size_t size_;
+	PEImageLayout layout_;
+	bool valid_;
+
+	uint32_t time_date_stamp_;
+	uint32_t size_of_image_;
+	uint32_t size_of_headers_;
+	uint64_t image_base_;
+	uint32_t relocations_rva_;
+	uint32_t relocations_size_;
+	uint32_t iat_rva_;
+	uint32_t iat_size_;
+	std::vector<PESection> sections_;
+
+	bool Parse();
+
+	// Where the bytes of a section that come from the file end, relative to its
+	// VirtualAddress
+	static uint32_t GetFileBackedSize(const PESection &section) {
+		uint32_t virtual_size = section.VirtualSize != 0 ? section.VirtualSize : section.RawSize;
+		return virtual_size < section.RawSize ? virtual_size : section.RawSize;
+	}
+
+public:
+	PEImage(const void *data, size_t size, PEImageLayout layout);
+
+	bool IsValid() const {
+		return valid_;
+	}
+
+	PEImageLayout GetLayout() const {
+		return layout_;
+	}
+
+	uint32_t GetTimeDateStamp() const {
+		return time_date_stamp_;
+	}
+
+	uint32_t GetSizeOfImage() const {
+		return size_of_image_;
+	}
+
+	// The preferred base from the headers, the loader overwrites it with the
+	// actual base in a loaded image
+	uint64_t GetImageBase() const {
+		return image_base_;
+	}
+
+	const std::vector<PESection> &GetSections() const {
+		return sections_;
+	}
+
+	// size bytes at rva, or nullptr if they aren't all inside the view
+	const uint8_t *GetPointer(uint32_t rva, size_t size = 1) const;
+
+	// RVA of an address inside the view, false if it doesn't belong to the image
+	bool GetRVA(const void *address, uint32_t &rva) const;
+
+	// Executable sections, the whole virtual size for a loaded image and only
+	// the part that is in the file otherwise
+	std::vector<ScanRange> GetCodeRanges() const;
+
+	// Spots the loader writes to, as RVA and size: relocation targets and the
+	// import address table
+	std::vector<std::pair<uint32_t, uint32_t>> GetLoaderPatches() const;
+
+	uint64_t GetCodeHash() const;
+
+	ModuleIdentity GetIdentity() const;
+};
+}
+
+#endif // INDIGO_UTILITY_PE_IMAGE_H_
@@ -0,0 +1,144 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef indigo_signature_hpp_
+#define indigo_signature_hpp_
+
+// Required libraries
+#include "pattern_scanner.hpp"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+namespace indigo {
+// IDA style byte pattern that is parsed once, like "E8 ?? ?? ?? ?? 8B 45".
+// Bytes are hex and separated by spaces, "?" or "??" is a wildcard. A pattern
+// that doesn't parse gives an invalid signature that never matches.
+// Example:
+//    Signature signature("55 8B EC ?? 8B 45 08");
+//    const uint8_t *match = signature.Find(start, length);
+class Signature {
+	std::string text_;
+	std::vector<uint8_t> bytes_;
+	std::string mask_; // 'x' for a fixed byte, '?' for a wildcard
+	PatternScanner scanner_;
+
+	static bool IsHex(char character) {
+		return (character >= '0' && character <= '9') || (character >= 'a' && character <= 'f') || (character >= 'A' && character <= 'F');
+	}
+
+	static bool Parse(const std::string &text, std::vector<uint8_t> &bytes, std::string &mask) {
+		size_t position = 0;
+		while (true) {
+			position = text.find_first_not_of(" \t", position);
+			if (position == std::string::npos) {
+				break;
+			}
+
+			size_t end = text.find_first_of(" \t", position);
+			std::string token = text.substr(position, end == std::string::npos ? std::string::npos : end - position);
+			position = end;
+
+			if (token == "?" || token == "??") {
+				bytes.push_back(0);
+				mask += '?';
+			} else if (token.size() <= 2 && IsHex(token[0]) && (token.size() == 1 || IsHex(token[1]))) {
+				bytes.push_back(static_cast<uint8_t>(strtoul(token.c_str(), nullptr, 16)));
+				mask += 'x';
+			} else {
+				return false;
+			}
+
+			if (end == std::string::npos) {
+				break;
+			}
+		}
+		return !bytes.empty();
+	}
+
+public:
+	Signature(const std::string &text) : text_(text) {
+		if (!Parse(text_, bytes_, mask_)) {
+			bytes_.clear();
+			mask_.clear();
+		}
+		scanner_ = PatternScanner(bytes_.data(), mask_.c_str());
+	}
+
+	Signature(const char *text) : Signature(std::string(text)) {
+	}
+
+	bool IsValid() const {
+		return !bytes_.empty();
+	}
+
+	const std::string &GetText() const {
+		return text_;
+	}
+
+	size_t GetLength() const {
+		return bytes_.size();
+	}
+
+	const uint8_t *GetBytes() const {
+		return bytes_.data();
+	}
+
+	bool IsFixed(size_t index) const {
+		return mask_[index] != '?';
+	}
+
+	// Normalized pattern text, "55 8B ?? 0C" for " 55 8b ? c"
+	std::string ToString() const {
+		static const char kDigits[] = "0123456789ABCDEF";
+		std::string text;
+		for (size_t i = 0; i < bytes_.size(); i++) {
+			if (i > 0) {
+				text += ' ';
+			}
+			if (IsFixed(i)) {
+				text += kDigits[bytes_[i] >> 4];
+				text += kDigits[bytes_[i] & 0xF];
+			} else {
+				text += "??";
+			}
+		}
+		return text;
+	}
+
+	// Whether the GetLength bytes at position match
+	bool Matches(const uint8_t *position) const {
+		for (size_t i = 0; i < bytes_.size(); i++) {
+			if (mask_[i] != '?' && position[i] != bytes_[i]) {
+				return false;
+			}
+		}
+		return IsValid();
+	}
+
+	// First match that lies entirely within [start, start + length), or nullptr
+	const uint8_t *Find(const uint8_t *start, size_t length) const {
+		return IsValid() ? scanner_.Find(start, length) : nullptr;
+	}
+
+	// Every match within [start, start + length), matches may overlap
+	std::vector<const uint8_t *> FindAll(const uint8_t *start, size_t length) const {
+		std::vector<const uint8_t *> matches;
+		const uint8_t *end = start + length;
+		const uint8_t *match = Find(start, length);
+		while (match != nullptr) {
+			matches.push_back(match);
+			match = Find(match + 1, end - (match + 1));
+		}
+		return matches;
+	}
+};
+}
+
+#endif // indigo_signature_hpp_
@@ -0,0 +1,164 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "signature_cache.hpp"
+#include "../platform.h"
+#include <stdio.h>
+#include <string.h>
+#if defined(OS_WIN)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#endif
+
+namespace indigo {
+static FILE *cache_open(const std::string &path, const char *mode) {
+	FILE *file = nullptr;
+#if defined(OS_WIN)
+	if (fopen_s(&file, path.c_str(), mode) != 0) {
+		return nullptr;
+	}
+#else
+	file = fopen(path.c_str(), mode);
+#endif
+	return file;
+}
+
+const SignatureCache::Entry *SignatureCache::FindEntry(const ModuleIdentity &module, const std::string &pattern) const {
+	for (const Entry &entry : entries_) {
+		if (entry.Module == module && entry.Pattern == pattern) {
+			return &entry;
+		}
+	}
+	return nullptr;
+}
+
+bool SignatureCache::Load(const std::string &path) {
+	FILE *file = cache_open(path, "r");
+	if (file == nullptr) {
+		return false;
+	}
+
+	entries_.clear();
+	dirty_ = false;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		if (line[0] == '#') {
+			continue;
+		}
+
+		unsigned int time_date_stamp, size_of_image, rva;
+		unsigned long long code_hash;
+		int pattern_offset = 0;
+#if defined(OS_WIN)
+		int fields = sscanf_s(line, "%x %x %llx %x %n", &time_date_stamp, &size_of_image, &code_hash, &rva, &pattern_offset);
+#else
+		int fields = sscanf(line, "%x %x %llx %x %n", &time_date_stamp, &size_of_image, &code_hash, &rva, &pattern_offset);
+#endif
+		if (fields != 4 || pattern_offset == 0) {
+			continue;
+		}
+
+		// Normalized again in case the file was edited by hand
+		Signature signature(std::string(line + pattern_offset, strcspn(line + pattern_offset, "\r\n")));
+		if (!signature.IsValid()) {
+			continue;
+		}
+
+		Entry entry;
+		entry.Module.TimeDateStamp = time_date_stamp;
+		entry.Module.SizeOfImage = size_of_image;
+		entry.Module.CodeHash = code_hash;
+		entry.Pattern = signature.ToString();
+		entry.RVA = rva;
+		entries_.push_back(entry);
+	}
+
+	fclose(file);
+	return true;
+}
+
+bool SignatureCache::Save(const std::string &path) {
+	std::string temporary = path + ".tmp";
+	FILE *file = cache_open(temporary, "w");
+	if (file == nullptr) {
+		return false;
+	}
+
+	bool written = fputs("# TimeDateStamp SizeOfImage CodeHash RVA Signature\n", file) >= 0;
+	for (const Entry &entry : entries_) {
+		written &= fprintf(file, "%08X %08X %016llX %08X %s\n", entry.Module.TimeDateStamp, entry.Module.SizeOfImage,
+			static_cast<unsigned long long>(entry.Module.CodeHash), entry.RVA, entry.Pattern.c_str()) > 0;
+	}
+	written &= fclose(file) == 0;
+
+	if (!written) {
+		remove(temporary.c_str());
+		return false;
+	}
+
+	// Replace the old cache in one step, rename refuses to on Windows
+#if defined(OS_WIN)
+	if (MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) == FALSE) {
+#else
+	if (rename(temporary.c_str(), path.c_str()) != 0) {
+#endif
+		remove(temporary.c_str());
+		return false;
+	}
+
+	dirty_ = false;
+	return true;
+}
+
+bool SignatureCache::Find(const ModuleIdentity &module, const Signature &signature, uint32_t &rva) const {
+	const Entry *entry = FindEntry(module, signature.ToString());
+	if (entry == nullptr) {
+		return false;
+	}
+	rva = entry->RVA;
+	return true;
+}
+
+bool SignatureCache::Resolve(const PEImage &image, const ModuleIdentity &module, const Signature &signature, uint32_t &rva) const {
+	uint32_t cached;
+	if (!Find(module, signature, cached)) {
+		return false;
+	}
+
+	const uint8_t *position = image.GetPointer(cached, signature.GetLength());
+	if (position == nullptr || !signature.Matches(position)) {
+		return false;
+	}
+
+	rva = cached;
+	return true;
+}
+
+void SignatureCache::Store(const ModuleIdentity &module, const Signature &signature, uint32_t rva) {
+	std::string pattern = signature.ToString();
+	for (Entry &entry : entries_) {
+		if (entry.Module == module && entry.Pattern == pattern) {
+			if (entry.RVA != rva) {
+				entry.RVA = rva;
+				dirty_ = true;
+			}
+			return;
+		}
+	}
+
+	Entry entry;
+	entry.Module = module;
+	entry.Pattern = pattern;
+	entry.RVA = rva;
+	entries_.push_back(entry);
+	dirty_ = true;
+}
+}
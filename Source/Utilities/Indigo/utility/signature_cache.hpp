@@ -0,0 +1,76 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef INDIGO_UTILITY_SIGNATURE_CACHE_H_
+#define INDIGO_UTILITY_SIGNATURE_CACHE_H_
+
+#include "pe_image.hpp"
+#include "signature.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace indigo {
+// Where signatures were found in a module, kept on disk so a module that
+// didn't change doesn't have to be scanned again. Entries are keyed by the
+// module's identity and the normalized signature text. The file is plain
+// text with one entry per line:
+//    <TimeDateStamp> <SizeOfImage> <CodeHash> <RVA> <signature>
+// Example:
+//    SignatureCache cache;
+//    cache.Load("curldump.cache");
+//    uint32_t rva;
+//    if (!cache.Resolve(image, identity, signature, rva)) {
+//        ... scan, then cache.Store(identity, signature, rva) and cache.Save
+//    }
+class SignatureCache {
+	struct Entry {
+		ModuleIdentity Module;
+		std::string Pattern;
+		uint32_t RVA;
+	};
+
+	std::vector<Entry> entries_;
+	bool dirty_;
+
+	const Entry *FindEntry(const ModuleIdentity &module, const std::string &pattern) const;
+
+public:
+	SignatureCache() : dirty_(false) {
+	}
+
+	// Replaces the entries with the ones in the file. Lines that don't parse
+	// are skipped, false if the file can't be read.
+	bool Load(const std::string &path);
+
+	// Writes all entries, through a temporary file so a reader never sees half
+	// a cache
+	bool Save(const std::string &path);
+
+	// Cached RVA of signature in module, if there is one
+	bool Find(const ModuleIdentity &module, const Signature &signature, uint32_t &rva) const;
+
+	// Same, but the signature also has to match at that RVA in image, which
+	// costs one compare of the signature's length
+	bool Resolve(const PEImage &image, const ModuleIdentity &module, const Signature &signature, uint32_t &rva) const;
+
+	// Adds or replaces an entry
+	void Store(const ModuleIdentity &module, const Signature &signature, uint32_t rva);
+
+	// Whether there are entries that weren't saved yet
+	bool IsDirty() const {
+		return dirty_;
+	}
+
+	size_t GetCount() const {
+		return entries_.size();
+	}
+};
+}
+
+#endif // INDIGO_UTILITY_SIGNATURE_CACHE_H_
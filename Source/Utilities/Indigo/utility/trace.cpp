@@ -0,0 +1,310 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "trace.hpp"
+#include "../platform.h"
+#include "../core/clock.hpp"
+#include "../core/ring_buffer.hpp"
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace indigo {
+static const size_t kTraceRingSize = 64 * 1024;
+static const uint32_t kTraceInterval = 10; // Milliseconds between drains
+
+struct TraceRecord {
+	uint64_t Counter; // Clock::GetCounter when written
+	const char *Format;
+	uint32_t Level;
+	uint32_t Thread;
+};
+
+struct TraceRing {
+	RingBuffer Ring;
+	uint32_t Thread;
+	std::atomic<uint64_t> Dropped;
+
+	TraceRing(uint32_t thread) : Ring(kTraceRingSize), Thread(thread), Dropped(0) {
+	}
+};
+
+// A formatted record waiting to be written
+struct TraceLine {
+	uint64_t Counter;
+	std::string Text;
+};
+
+static std::mutex trace_mutex;
+static std::condition_variable trace_condition;
+static std::vector<std::shared_ptr<TraceRing>> trace_rings;
+static std::thread trace_thread;
+static bool trace_running = false;
+static FILE *trace_output = nullptr;
+static Clock trace_clock;
+static uint32_t trace_threads = 0;
+static std::atomic<uint64_t> trace_dropped(0);
+
+const char *trace_level_name(uint32_t level) {
+	switch (level) {
+	case kTraceLevel_Error:
+		return "ERROR";
+	case kTraceLevel_Warning:
+		return "WARNING";
+	case kTraceLevel_Info:
+		return "INFO";
+	case kTraceLevel_Debug:
+		return "DEBUG";
+	case kTraceLevel_Verbose:
+		return "VERBOSE";
+	default:
+		return "UNKN";
+	}
+}
+
+// The calling thread's ring, registered on first use. The list keeps a
+// reference so records of a thread that exited are still written.
+TraceRing &trace_ring() {
+	thread_local std::shared_ptr<TraceRing> ring;
+	if (!ring) {
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		ring = std::make_shared<TraceRing>(++trace_threads);
+		trace_rings.push_back(ring);
+	}
+	return *ring;
+}
+
+std::string trace_format_line(const TraceRecord &record, const uint8_t *arguments, size_t size) {
+	uint64_t time = trace_clock.ToTime(record.Counter);
+	time_t seconds = static_cast<time_t>(time / 1000000000ULL);
+	tm local_time;
+#if defined(OS_WIN)
+	localtime_s(&local_time, &seconds);
+#else
+	localtime_r(&seconds, &local_time);
+#endif
+
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), "[%02d:%02d:%02d.%06u][%u][%s] ", local_time.tm_hour, local_time.tm_min, local_time.tm_sec,
+		static_cast<uint32_t>(time % 1000000000ULL / 1000), record.Thread, trace_level_name(record.Level));
+
+	return prefix + TraceArguments::Format(record.Format, arguments, size) + "\n";
+}
+
+// Formats and writes every record that is in the rings, oldest first
+void trace_drain() {
+	std::vector<std::shared_ptr<TraceRing>> rings;
+	{
+		std::lock_guard<std::mutex> lock(trace_mutex);
+
+		// Forget rings of threads that exited once they are empty
+		trace_rings.erase(std::remove_if(trace_rings.begin(), trace_rings.end(), [](const std::shared_ptr<TraceRing> &ring) {
+			return ring.use_count() == 1 && ring->Ring.IsEmpty();
+		}), trace_rings.end());
+		rings = trace_rings;
+	}
+
+	std::vector<TraceLine> lines;
+	uint64_t dropped = 0;
+	for (auto &ring : rings) {
+		ring->Ring.Read([&](const uint8_t *data, size_t size) {
+			TraceRecord record;
+			memcpy(&record, data, sizeof(TraceRecord));
+
+			TraceLine line;
+			line.Counter = record.Counter;
+			line.Text = trace_format_line(record, data + sizeof(TraceRecord), size - sizeof(TraceRecord));
+			lines.push_back(std::move(line));
+		});
+		dropped += ring->Dropped.exchange(0, std::memory_order_relaxed);
+	}
+
+	// Each ring is in order already, a stable sort interleaves the threads
+	std::stable_sort(lines.begin(), lines.end(), [](const TraceLine &left, const TraceLine &right) {
+		return left.Counter < right.Counter;
+	});
+
+	for (auto &line : lines) {
+		fputs(line.Text.c_str(), trace_output);
+	}
+	if (dropped > 0) {
+		fprintf(trace_output, "[trace] %llu records dropped\n", static_cast<unsigned long long>(dropped));
+	}
+	if (!lines.empty() || dropped > 0) {
+		fflush(trace_output);
+	}
+}
+
+void trace_thread_main() {
+	std::unique_lock<std::mutex> lock(trace_mutex);
+	while (trace_running) {
+		trace_condition.wait_for(lock, std::chrono::milliseconds(kTraceInterval));
+
+		lock.unlock();
+		trace_drain();
+		lock.lock();
+	}
+}
+
+std::atomic<uint32_t> Trace::level_(INDIGO_TRACE_LEVEL);
+
+void Trace::Start(FILE *output) {
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	if (trace_running) {
+		return;
+	}
+
+	trace_output = output;
+	trace_clock.Calibrate();
+	trace_running = true;
+	trace_thread = std::thread(trace_thread_main);
+}
+
+void Trace::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		if (!trace_running) {
+			return;
+		}
+		trace_running = false;
+	}
+
+	trace_condition.notify_one();
+	trace_thread.join();
+
+	// Whatever came in after the last drain
+	trace_drain();
+}
+
+void Trace::Commit(TraceLevel level, const char *format, const uint8_t *arguments, size_t size) {
+	TraceRing &ring = trace_ring();
+
+	TraceRecord record = { Clock::GetCounter(), format, static_cast<uint32_t>(level), ring.Thread };
+	if (!ring.Ring.Write(&record, sizeof(TraceRecord), arguments, size)) {
+		ring.Dropped.fetch_add(1, std::memory_order_relaxed);
+		trace_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+uint64_t Trace::GetRecordsDropped() {
+	return trace_dropped.load(std::memory_order_relaxed);
+}
+
+std::string TraceArguments::Format(const char *format, const uint8_t *arguments, size_t size) {
+	std::string output;
+	size_t offset = 0;
+	char buffer[512];
+
+	for (const char *character = format; *character != '\0'; character++) {
+		if (*character != '%') {
+			output += *character;
+			continue;
+		}
+		if (character[1] == '%') {
+			output += '%';
+			character++;
+			continue;
+		}
+
+		// Flags, width and precision are kept, length modifiers are dropped
+		std::string spec = "%";
+		const char *end = character + 1;
+		while (*end != '\0' && strchr("-+ #0123456789.", *end) != nullptr) {
+			spec += *end++;
+		}
+		while (*end != '\0' && strchr("hlLqjztI", *end) != nullptr) {
+			if (*end == 'I' && (strncmp(end, "I64", 3) == 0 || strncmp(end, "I32", 3) == 0)) {
+				end += 3;
+			} else {
+				end++;
+			}
+		}
+		char conversion = *end;
+		if (conversion == '\0') {
+			break;
+		}
+		character = end;
+
+		if (offset >= size) {
+			output += "(missing)";
+			continue;
+		}
+
+		uint8_t tag = arguments[offset++];
+		if (tag == kTag_String) {
+			size_t length = arguments[offset++];
+			std::string string(reinterpret_cast<const char *>(&arguments[offset]), length);
+			offset += length;
+			if (conversion == 's') {
+				snprintf(buffer, sizeof(buffer), (spec + 's').c_str(), string.c_str());
+				output += buffer;
+			} else {
+				output += string;
+			}
+			continue;
+		}
+
+		uint64_t value;
+		memcpy(&value, &arguments[offset], sizeof(value));
+		offset += sizeof(value);
+
+		switch (conversion) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			if (tag == kTag_Double) {
+				double number;
+				memcpy(&number, &value, sizeof(number));
+				snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(), static_cast<long long>(number));
+			} else if (conversion == 'd' || conversion == 'i') {
+				snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(), static_cast<long long>(value));
+			} else {
+				snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(), static_cast<unsigned long long>(value));
+			}
+			break;
+		case 'c':
+			snprintf(buffer, sizeof(buffer), (spec + 'c').c_str(), static_cast<int>(value));
+			break;
+		case 'p':
+			snprintf(buffer, sizeof(buffer), (spec + 'p').c_str(), reinterpret_cast<void *>(static_cast<uintptr_t>(value)));
+			break;
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A': {
+			double number;
+			if (tag == kTag_Double) {
+				memcpy(&number, &value, sizeof(number));
+			} else {
+				number = tag == kTag_Signed ? static_cast<double>(static_cast<int64_t>(value)) : static_cast<double>(value);
+			}
+			snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(), number);
+			break;
+		}
+		default:
+			snprintf(buffer, sizeof(buffer), "(%%%c?)", conversion);
+			break;
+		}
+		output += buffer;
+	}
+
+	return output;
+}
+}
@@ -0,0 +1,191 @@
+/*
+*   This file is part of the Indigo library.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef INDIGO_UTILITY_TRACE_H_
+#define INDIGO_UTILITY_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+namespace indigo {
+enum TraceLevel {
+	kTraceLevel_Error,
+	kTraceLevel_Warning,
+	kTraceLevel_Info,
+	kTraceLevel_Debug,
+	kTraceLevel_Verbose
+};
+
+// Levels above INDIGO_TRACE_LEVEL are compiled out. By default debug builds
+// keep everything and release builds stop at kTraceLevel_Info.
+#ifndef INDIGO_TRACE_LEVEL
+#if defined(_DEBUG)
+#define INDIGO_TRACE_LEVEL indigo::kTraceLevel_Verbose
+#else
+#define INDIGO_TRACE_LEVEL indigo::kTraceLevel_Info
+#endif
+#endif
+
+// printf style, the format must be a string literal since only its address
+// is recorded. A level that is compiled in but disabled costs one branch.
+#define INDIGO_TRACE(level, ...) \
+	do { \
+		if ((level) <= INDIGO_TRACE_LEVEL && indigo::Trace::IsEnabled(level)) { \
+			indigo::Trace::Write(level, __VA_ARGS__); \
+		} \
+	} while (0)
+
+// Arguments of a deferred printf call in a compact binary form: a type tag
+// and the value, strings are copied and cut at kMaxString bytes. Any integer,
+// floating point, pointer or string argument can be recorded.
+class TraceArguments {
+public:
+	static const size_t kMaxSize = 512;
+	static const size_t kMaxString = 255;
+
+	enum Tag : uint8_t {
+		kTag_Signed = 'i',
+		kTag_Unsigned = 'u',
+		kTag_Double = 'f',
+		kTag_Pointer = 'p',
+		kTag_String = 's'
+	};
+
+private:
+	uint8_t data_[kMaxSize];
+	size_t size_;
+
+	void Append(Tag tag, const void *value, size_t size) {
+		if (size_ + 1 + size > kMaxSize) {
+			return;
+		}
+		data_[size_++] = tag;
+		memcpy(&data_[size_], value, size);
+		size_ += size;
+	}
+
+	void AppendString(const char *string, size_t length) {
+		uint8_t size = static_cast<uint8_t>(length < kMaxString ? length : kMaxString);
+		if (size_ + 2 + size > kMaxSize) {
+			return;
+		}
+		data_[size_++] = kTag_String;
+		data_[size_++] = size;
+		memcpy(&data_[size_], string, size);
+		size_ += size;
+	}
+
+	template<typename _TValue>
+	typename std::enable_if<std::is_integral<_TValue>::value && std::is_signed<_TValue>::value>::type AddOne(_TValue value) {
+		int64_t encoded = value;
+		Append(kTag_Signed, &encoded, sizeof(encoded));
+	}
+
+	template<typename _TValue>
+	typename std::enable_if<std::is_integral<_TValue>::value && !std::is_signed<_TValue>::value>::type AddOne(_TValue value) {
+		uint64_t encoded = value;
+		Append(kTag_Unsigned, &encoded, sizeof(encoded));
+	}
+
+	template<typename _TValue>
+	typename std::enable_if<std::is_enum<_TValue>::value>::type AddOne(_TValue value) {
+		int64_t encoded = static_cast<int64_t>(value);
+		Append(kTag_Signed, &encoded, sizeof(encoded));
+	}
+
+	template<typename _TValue>
+	typename std::enable_if<std::is_floating_point<_TValue>::value>::type AddOne(_TValue value) {
+		double encoded = value;
+		Append(kTag_Double, &encoded, sizeof(encoded));
+	}
+
+	template<typename _TValue>
+	typename std::enable_if<std::is_pointer<_TValue>::value && !std::is_same<typename std::decay<typename std::remove_pointer<_TValue>::type>::type,
+		char>::value>::type AddOne(_TValue value) {
+		uint64_t encoded = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value));
+		Append(kTag_Pointer, &encoded, sizeof(encoded));
+	}
+
+	void AddOne(const char *string) {
+		if (string == nullptr) {
+			string = "(null)";
+		}
+		AppendString(string, strlen(string));
+	}
+
+	void AddOne(const std::string &string) {
+		AppendString(string.data(), string.size());
+	}
+
+public:
+	TraceArguments() : size_(0) {
+	}
+
+	void Add() {
+	}
+
+	template<typename _TFirst, typename... _TRest>
+	void Add(const _TFirst &first, const _TRest &... rest) {
+		AddOne(first);
+		Add(rest...);
+	}
+
+	const uint8_t *GetData() const {
+		return data_;
+	}
+
+	size_t GetSize() const {
+		return size_;
+	}
+
+	// Runs a printf format over recorded arguments. Length modifiers in the
+	// format are ignored, every value is printed at its recorded width.
+	static std::string Format(const char *format, const uint8_t *arguments, size_t size);
+};
+
+// Leveled trace for hot paths. Write only encodes the record into a ring that
+// belongs to the calling thread, a background thread started by Start formats
+// the records and writes them to the output in time order.
+class Trace {
+	static std::atomic<uint32_t> level_;
+
+	static void Commit(TraceLevel level, const char *format, const uint8_t *arguments, size_t size);
+
+public:
+	// Starts the thread that writes records to output
+	static void Start(FILE *output = stdout);
+
+	// Writes what is left and stops the thread
+	static void Stop();
+
+	// Levels above this one are skipped at runtime
+	static void SetLevel(TraceLevel level) {
+		level_.store(level, std::memory_order_relaxed);
+	}
+
+	static bool IsEnabled(TraceLevel level) {
+		return static_cast<uint32_t>(level) <= level_.load(std::memory_order_relaxed);
+	}
+
+	template<typename... _TArgs>
+	static void Write(TraceLevel level, const char *format, const _TArgs &... args) {
+		TraceArguments arguments;
+		arguments.Add(args...);
+		Commit(level, format, arguments.GetData(), arguments.GetSize());
+	}
+
+	// Records lost to full rings so far
+	static uint64_t GetRecordsDropped();
+};
+}
+
+#endif // INDIGO_UTILITY_TRACE_H_
@@ -0,0 +1,132 @@
+/*
+*
+*   Title: CurlDump Scanner Benchmark
+*
+*   Times the byte-by-byte loop Memory::Find used to run against
+*   PatternScanner on a large buffer of code-like bytes, and checks that
+*   both find the same match.
+*
+*/
+
+#include "Utilities/Indigo/utility/pattern_scanner.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Memory::Find before PatternScanner, kept as it was
+void *byte_loop_find(void *start_address, size_t search_length, const char *pattern, const char *mask) {
+	size_t mask_length = strlen(mask);
+
+	for (size_t i = 0; i < search_length - mask_length; ++i) {
+		size_t found_bytes = 0;
+
+		for (size_t j = 0; j < mask_length; ++j) {
+			char byte_read = *reinterpret_cast<char *>(static_cast<char *>(start_address) + i + j);
+
+			if (byte_read != pattern[j] && mask[j] != '?') {
+				break;
+			}
+
+			++found_bytes;
+
+			if (found_bytes == mask_length) {
+				return static_cast<char *>(start_address) + i;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+// Half random bytes and half the opcodes and operands x86 code is full of,
+// so the anchors see a realistic mix of near misses
+void fill_code(std::vector<uint8_t> &buffer) {
+	static const uint8_t kCommon[] = { 0x00, 0xFF, 0x8B, 0x48, 0x89, 0x24, 0xCC, 0x44, 0x0F, 0xE8, 0x83, 0x45, 0x8D };
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	for (uint8_t &value : buffer) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		value = (state & 0x100) != 0 ? kCommon[(state >> 16) % sizeof(kCommon)] : static_cast<uint8_t>(state);
+	}
+}
+
+const char *level_name(indigo::ScannerLevel level) {
+	switch (level) {
+	case indigo::kScannerLevel_AVX2:
+		return "AVX2";
+	case indigo::kScannerLevel_SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+	size_t megabytes = 150;
+	int runs = 3;
+
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--size" && i + 1 < argc) {
+			megabytes = strtoul(argv[++i], nullptr, 10);
+		} else if (argument == "--runs" && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		} else {
+			printf("Usage: %s [--size <MB>] [--runs <n>]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (megabytes == 0 || runs <= 0) {
+		printf("--size and --runs have to be positive\n");
+		return 2;
+	}
+
+	// A function prologue with a wildcarded stack size, placed near the end so
+	// both searches walk the whole buffer
+	static const uint8_t kPattern[] = { 0x55, 0x8B, 0xEC, 0x81, 0xEC, 0x00, 0x00, 0x00, 0x00, 0x53, 0x56, 0x57, 0x8B, 0x7D, 0x08 };
+	static const char kMask[] = "xxxxx????xxxxxx";
+
+	std::vector<uint8_t> buffer(megabytes * 1024 * 1024);
+	fill_code(buffer);
+	size_t expected = buffer.size() - 100;
+	memcpy(&buffer[expected], kPattern, sizeof(kPattern));
+
+	indigo::PatternScanner scanner(kPattern, kMask);
+	printf("%zu MB, PatternScanner uses %s\n", megabytes, level_name(indigo::PatternScanner::GetLevel()));
+
+	double best_loop = 0, best_scanner = 0;
+	for (int run = 0; run < runs; run++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		void *loop_match = byte_loop_find(buffer.data(), buffer.size(), reinterpret_cast<const char *>(kPattern), kMask);
+		double loop_ms = elapsed_ms(start);
+
+		start = std::chrono::steady_clock::now();
+		const uint8_t *scanner_match = scanner.Find(buffer.data(), buffer.size());
+		double scanner_ms = elapsed_ms(start);
+
+		if (loop_match != scanner_match || scanner_match != &buffer[expected]) {
+			printf("Matches differ: byte loop %p, PatternScanner %p, expected %p\n", loop_match, static_cast<const void *>(scanner_match),
+				static_cast<const void *>(&buffer[expected]));
+			return 1;
+		}
+
+		printf("  run %d: byte loop %8.1f ms, PatternScanner %6.1f ms\n", run + 1, loop_ms, scanner_ms);
+		best_loop = run == 0 || loop_ms < best_loop ? loop_ms : best_loop;
+		best_scanner = run == 0 || scanner_ms < best_scanner ? scanner_ms : best_scanner;
+	}
+
+	double buffer_megabytes = static_cast<double>(buffer.size()) / (1024.0 * 1024.0);
+	printf("best: byte loop %.1f ms (%.0f MB/s), PatternScanner %.1f ms (%.0f MB/s), %.1fx\n", best_loop, buffer_megabytes * 1000.0 / best_loop,
+		best_scanner, buffer_megabytes * 1000.0 / best_scanner, best_loop / best_scanner);
+
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+*
+*   Title: CurlDump Signature Resolver
+*
+*   Resolves the patterns in curldump.ini against a program on disk and
+*   writes them to the signature cache, so CurlDump finds its hook targets
+*   without scanning.
+*
+*/
+
+#include "Utilities/Indigo/platform.h"
+#include "Utilities/Indigo/utility/config.hpp"
+#include "Utilities/Indigo/utility/multi_scanner.hpp"
+#include "Utilities/Indigo/utility/pe_image.hpp"
+#include "Utilities/Indigo/utility/signature_cache.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(OS_WIN)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A file mapped read-only into memory
+struct MappedFile {
+	const uint8_t *Data;
+	size_t Size;
+#if defined(OS_WIN)
+	HANDLE File;
+	HANDLE Mapping;
+#else
+	int File;
+#endif
+};
+
+bool map_file(const std::string &path, MappedFile &mapped) {
+	mapped.Data = nullptr;
+	mapped.Size = 0;
+
+#if defined(OS_WIN)
+	mapped.File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mapped.File == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped.File, &size) || size.QuadPart == 0) {
+		CloseHandle(mapped.File);
+		return false;
+	}
+
+	mapped.Mapping = CreateFileMappingA(mapped.File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapped.Mapping == nullptr) {
+		CloseHandle(mapped.File);
+		return false;
+	}
+
+	mapped.Data = static_cast<const uint8_t *>(MapViewOfFile(mapped.Mapping, FILE_MAP_READ, 0, 0, 0));
+	if (mapped.Data == nullptr) {
+		CloseHandle(mapped.Mapping);
+		CloseHandle(mapped.File);
+		return false;
+	}
+	mapped.Size = static_cast<size_t>(size.QuadPart);
+#else
+	mapped.File = open(path.c_str(), O_RDONLY);
+	if (mapped.File < 0) {
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(mapped.File, &status) != 0 || status.st_size == 0) {
+		close(mapped.File);
+		return false;
+	}
+
+	void *data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, mapped.File, 0);
+	if (data == MAP_FAILED) {
+		close(mapped.File);
+		return false;
+	}
+	mapped.Data = static_cast<const uint8_t *>(data);
+	mapped.Size = static_cast<size_t>(status.st_size);
+#endif
+
+	return true;
+}
+
+void unmap_file(MappedFile &mapped) {
+	if (mapped.Data == nullptr) {
+		return;
+	}
+
+#if defined(OS_WIN)
+	UnmapViewOfFile(mapped.Data);
+	CloseHandle(mapped.Mapping);
+	CloseHandle(mapped.File);
+#else
+	munmap(const_cast<uint8_t *>(mapped.Data), mapped.Size);
+	close(mapped.File);
+#endif
+
+	mapped.Data = nullptr;
+}
+
+void print_usage(const char *name) {
+	printf("Usage: %s [options] <program.exe>\n", name);
+	printf("  --config <file>   Patterns to resolve (default: curldump.ini)\n");
+	printf("  --cache <file>    Cache to update (default: Cache from the config, or curldump.cache)\n");
+	printf("  --threads <n>     Scan workers, 0 for one per core (default: ScanThreads from the config)\n");
+	printf("  --dry-run         Resolve and print, but don't write the cache\n");
+}
+
+int main(int argc, char **argv) {
+	std::string config_path = "curldump.ini";
+	std::string cache_path;
+	std::string image_path;
+	int64_t threads = -1;
+	bool dry_run = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--config" && i + 1 < argc) {
+			config_path = argv[++i];
+		} else if (argument == "--cache" && i + 1 < argc) {
+			cache_path = argv[++i];
+		} else if (argument == "--threads" && i + 1 < argc) {
+			threads = strtoll(argv[++i], nullptr, 10);
+		} else if (argument == "--dry-run") {
+			dry_run = true;
+		} else if (argument[0] != '-' && image_path.empty()) {
+			image_path = argument;
+		} else {
+			print_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (image_path.empty()) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	// Same settings as the extension reads
+	std::ifstream config_file(config_path, std::ios::binary);
+	if (!config_file.is_open()) {
+		printf("Failed to open %s\n", config_path.c_str());
+		return 2;
+	}
+	std::string config_buffer((std::istreambuf_iterator<char>(config_file)), std::istreambuf_iterator<char>());
+
+	indigo::Config config;
+	if (!config.Open(config_buffer)) {
+		printf("Failed to read %s\n", config_path.c_str());
+		return 2;
+	}
+
+	if (cache_path.empty()) {
+		cache_path = config.GetString("CURL", "Cache", "curldump.cache");
+		if (cache_path.empty()) {
+			cache_path = "curldump.cache";
+		}
+	}
+	if (threads < 0) {
+		threads = config.GetInteger("CURL", "ScanThreads", 0);
+	}
+	bool all_sections = config.GetInteger("CURL", "ScanAllSections", 0) != 0;
+
+	const char *names[] = { "SetOpt", "Close" };
+	indigo::MultiScanner scanner;
+	for (const char *name : names) {
+		size_t index = scanner.Add(indigo::Signature(config.GetString("CURL", name)));
+		if (!scanner.Get(index).IsValid()) {
+			printf("Invalid %s pattern in %s\n", name, config_path.c_str());
+			return 2;
+		}
+	}
+	scanner.Compile();
+
+	MappedFile mapped;
+	if (!map_file(image_path, mapped)) {
+		printf("Failed to map %s\n", image_path.c_str());
+		return 2;
+	}
+
+	indigo::PEImage image(mapped.Data, mapped.Size, indigo::kPEImageLayout_File);
+	if (!image.IsValid()) {
+		printf("%s is not a PE image\n", image_path.c_str());
+		unmap_file(mapped);
+		return 2;
+	}
+
+	indigo::ModuleIdentity identity = image.GetIdentity();
+	printf("%s: TimeDateStamp %08X, SizeOfImage %08X, CodeHash %016llX\n", image_path.c_str(), identity.TimeDateStamp, identity.SizeOfImage,
+		static_cast<unsigned long long>(identity.CodeHash));
+
+	// The extension searches the whole loaded image with ScanAllSections, the
+	// closest thing in the file is every section
+	std::vector<indigo::ScanRange> ranges;
+	if (all_sections) {
+		for (const indigo::PESection &section : image.GetSections()) {
+			uint32_t virtual_size = section.VirtualSize != 0 ? section.VirtualSize : section.RawSize;
+			uint32_t length = virtual_size < section.RawSize ? virtual_size : section.RawSize;
+			const uint8_t *start = image.GetPointer(section.VirtualAddress, length);
+			if (start != nullptr && length > 0) {
+				ranges.push_back(indigo::ScanRange{ start, length });
+			}
+		}
+	} else {
+		ranges = image.GetCodeRanges();
+	}
+
+	std::vector<const uint8_t *> matches = scanner.FindFirst(ranges, static_cast<size_t>(threads));
+
+	indigo::SignatureCache cache;
+	cache.Load(cache_path);
+
+	bool resolved = true;
+	for (size_t i = 0; i < matches.size(); i++) {
+		uint32_t rva;
+		if (matches[i] == nullptr || !image.GetRVA(matches[i], rva)) {
+			printf("  %-6s not found\n", names[i]);
+			resolved = false;
+			continue;
+		}
+
+		printf("  %-6s RVA %08X (file offset %08X)\n", names[i], rva, static_cast<uint32_t>(matches[i] - mapped.Data));
+		cache.Store(identity, scanner.Get(i), rva);
+	}
+
+	unmap_file(mapped);
+
+	if (!dry_run && cache.IsDirty()) {
+		if (!cache.Save(cache_path)) {
+			printf("Failed to write %s\n", cache_path.c_str());
+			return 2;
+		}
+		printf("Updated %s\n", cache_path.c_str());
+	}
+
+	return resolved ? 0 : 1;
+}
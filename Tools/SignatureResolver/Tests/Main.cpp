@@ -0,0 +1,176 @@
+/*
+*
+*   Title: CurlDump Signature Resolver Tests
+*
+*   Checks the pieces the resolver is built from against tiny32.exe, a
+*   hand-made 1.5 KB PE32 image:
+*     headers  file 0x000-0x1FF
+*     .text    file 0x200-0x3FF, RVA 0x1000, VirtualSize 0x100, int3 filled
+*              with a SetOpt-like prologue at RVA 0x1040 and a Close-like one
+*              at RVA 0x1090
+*     .data    file 0x400-0x5FF, RVA 0x2000, VirtualSize 0x80, a copy of the
+*              Close-like bytes at RVA 0x2010
+*
+*/
+
+#include "Utilities/Indigo/utility/multi_scanner.hpp"
+#include "Utilities/Indigo/utility/pe_image.hpp"
+#include "Utilities/Indigo/utility/signature_cache.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+bool read_file(const std::string &path, std::string &contents) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	contents.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	return true;
+}
+
+// File offsets map to the RVA of the section they are stored in, and back
+void test_rva_mapping(const indigo::PEImage &image, const uint8_t *data, size_t size) {
+	struct Mapping {
+		size_t Offset;
+		uint32_t RVA;
+	};
+	static const Mapping kMappings[] = {
+		{ 0x000, 0x0000 }, // Headers are at the same offset in the file
+		{ 0x1FF, 0x01FF },
+		{ 0x200, 0x1000 }, // First byte of .text
+		{ 0x240, 0x1040 },
+		{ 0x2FF, 0x10FF }, // Last byte of .text's VirtualSize
+		{ 0x410, 0x2010 }, // Inside .data
+	};
+
+	for (const Mapping &mapping : kMappings) {
+		uint32_t rva = 0xFFFFFFFF;
+		CHECK(image.GetRVA(data + mapping.Offset, rva));
+		CHECK(rva == mapping.RVA);
+		CHECK(image.GetPointer(mapping.RVA) == data + mapping.Offset);
+	}
+
+	// Raw padding past a section's VirtualSize isn't part of the image, and
+	// neither is anything outside the view
+	uint32_t rva;
+	uint8_t outside = 0;
+	CHECK(!image.GetRVA(data + 0x300, rva));
+	CHECK(!image.GetRVA(data + 0x480, rva));
+	CHECK(!image.GetRVA(data + size, rva));
+	CHECK(!image.GetRVA(&outside, rva));
+	CHECK(image.GetPointer(0x1100) == nullptr);
+	CHECK(image.GetPointer(0x10F0, 0x20) == nullptr);
+}
+
+void test_code_ranges(const indigo::PEImage &image, const uint8_t *data) {
+	std::vector<indigo::ScanRange> ranges = image.GetCodeRanges();
+	CHECK(ranges.size() == 1);
+	if (ranges.size() == 1) {
+		CHECK(ranges[0].Start == data + 0x200);
+		CHECK(ranges[0].Length == 0x100);
+	}
+}
+
+// The resolver scans the code ranges and turns the matches into RVAs
+void test_resolve(const indigo::PEImage &image) {
+	indigo::MultiScanner scanner;
+	scanner.Add(indigo::Signature("55 8B EC 83 EC ?? 53 56 57"));
+	scanner.Add(indigo::Signature("55 8B EC 56 8B 75 08"));
+	scanner.Compile();
+
+	std::vector<const uint8_t *> matches = scanner.FindFirst(image.GetCodeRanges(), 2);
+	CHECK(matches.size() == 2);
+	if (matches.size() != 2) {
+		return;
+	}
+
+	uint32_t rva = 0;
+	CHECK(matches[0] != nullptr && image.GetRVA(matches[0], rva) && rva == 0x1040);
+	CHECK(matches[1] != nullptr && image.GetRVA(matches[1], rva) && rva == 0x1090);
+}
+
+// Save writes a header and one line per entry in a fixed format that Load
+// and older caches on disk depend on
+void test_cache_format(const indigo::PEImage &image, const std::string &path) {
+	indigo::ModuleIdentity identity = image.GetIdentity();
+	CHECK(identity.TimeDateStamp == 0x5EADBEEF);
+	CHECK(identity.SizeOfImage == 0x3000);
+	CHECK(identity.CodeHash == 0x579768F3973EAC65ULL);
+
+	indigo::Signature setopt(" 55 8b ec 83 ec ? 53 56 57");
+	indigo::Signature close("55 8B EC 56 8B 75 08");
+
+	indigo::SignatureCache cache;
+	cache.Store(identity, setopt, 0x1040);
+	cache.Store(identity, close, 0x1090);
+	CHECK(cache.IsDirty());
+	CHECK(cache.Save(path));
+	CHECK(!cache.IsDirty());
+
+	std::string contents;
+	CHECK(read_file(path, contents));
+	CHECK(contents ==
+		"# TimeDateStamp SizeOfImage CodeHash RVA Signature\n"
+		"5EADBEEF 00003000 579768F3973EAC65 00001040 55 8B EC 83 EC ?? 53 56 57\n"
+		"5EADBEEF 00003000 579768F3973EAC65 00001090 55 8B EC 56 8B 75 08\n");
+
+	// And reads back to the same entries
+	indigo::SignatureCache loaded;
+	CHECK(loaded.Load(path));
+	CHECK(loaded.GetCount() == 2);
+	uint32_t rva = 0;
+	CHECK(loaded.Resolve(image, identity, setopt, rva) && rva == 0x1040);
+	CHECK(loaded.Resolve(image, identity, close, rva) && rva == 0x1090);
+
+	// A stale RVA is found but no longer matches
+	loaded.Store(identity, close, 0x1041);
+	CHECK(loaded.Find(identity, close, rva) && rva == 0x1041);
+	CHECK(!loaded.Resolve(image, identity, close, rva));
+
+	remove(path.c_str());
+}
+
+int main(int argc, char **argv) {
+	std::string fixture = argc > 1 ? argv[1] : "tiny32.exe";
+	std::string cache_path = argc > 2 ? argv[2] : "resolver_test.cache";
+
+	std::string contents;
+	if (!read_file(fixture, contents)) {
+		printf("Failed to read %s\n", fixture.c_str());
+		return 2;
+	}
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(contents.data());
+
+	indigo::PEImage image(data, contents.size(), indigo::kPEImageLayout_File);
+	CHECK(image.IsValid());
+	CHECK(image.GetSections().size() == 2);
+	if (!image.IsValid()) {
+		return 1;
+	}
+
+	test_rva_mapping(image, data, contents.size());
+	test_code_ranges(image, data);
+	test_resolve(image);
+	test_cache_format(image, cache_path);
+
+	if (failures > 0) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}